@@ -0,0 +1,9 @@
+#!/bin/bash
+# Time project/denormal.txt with denormals kept and flushed to zero.
+set -e
+for mode in ieee preserve-sign; do
+  ./a.out -O2 -fdenormal-fp-math=$mode project/denormal.txt > /dev/null
+  gcc project/main.c project/denormal.o -o project/denormal -lm
+  echo "-fdenormal-fp-math=$mode:"
+  time ./project/denormal
+done
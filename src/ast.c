@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const char *const AST_TYPE_STRING[] = {
   "error",
@@ -25,125 +26,306 @@ ast_type_string (enum ast_type type)
   return AST_TYPE_STRING[type];
 }
 
-struct ast *
-ast_create (enum ast_type type, struct location location, struct arena *arena)
+static const char *const AST_OPERATOR_STRING[] = {
+  "=", "+", "-", "*", "/", "<", ">", "<=", ">=",
+};
+
+/* The spelling of a built-in operator. */
+const char *
+ast_operator_string (enum ast_operator operator)
+{
+  return AST_OPERATOR_STRING[operator];
+}
+
+#define AST_GROW(array, capacity)                                             \
+  ((array) = realloc ((array), (capacity) * sizeof (*(array))))
+
+static void
+ast_grow (struct ast *ast)
+{
+  ast->capacity = ast->capacity ? ast->capacity * 2 : 256;
+
+  AST_GROW (ast->type, ast->capacity);
+  AST_GROW (ast->value, ast->capacity);
+  AST_GROW (ast->location, ast->capacity);
+  AST_GROW (ast->expr_type, ast->capacity);
+  AST_GROW (ast->binding, ast->capacity);
+  AST_GROW (ast->children, ast->capacity);
+  AST_GROW (ast->children_n, ast->capacity);
+  AST_GROW (ast->state, ast->capacity);
+}
+
+uint32_t
+ast_create (struct ast *ast, enum ast_type type, struct location location)
 {
-  struct ast *ast;
+  if (ast->size >= ast->capacity)
+    ast_grow (ast);
+
+  uint32_t node = ast->size++;
+
+  ast->type[node] = type;
+  ast->value[node].f = 0.0;
+  ast->location[node] = location;
+  ast->expr_type[node] = NULL;
+  ast->binding[node] = AST_UNBOUND;
+  ast->children[node] = 0;
+  ast->children_n[node] = 0;
+  ast->state[node] = 0;
 
-  if (arena)
-    ast = arena_alloc (arena, sizeof (struct ast));
-  else
-    ast = calloc (1, sizeof (struct ast));
+  return node;
+}
+
+uint32_t
+ast_create_e (struct ast *ast, struct error error, struct location location)
+{
+  uint32_t node = ast_create (ast, AST_ERROR, location);
 
-  ast->type = type;
-  ast->location = location;
-  ast->expr_type = NULL;
+  ast->value[node].error = diagnostics_add (&ast->errors, error);
 
-  return ast;
+  return node;
 }
 
-struct ast *
-ast_create_e (struct error error, struct location location,
-              struct arena *arena)
+/* Copy 'node' of 'source' and everything below it into 'ast'. Children
+   are copied first, and the copies of a node's children are the topmost
+   entries of the scratch stack once it is done. */
+uint32_t
+ast_copy (struct ast *ast, const struct ast *source, uint32_t node)
 {
-  struct ast *ast;
+  struct ast_walk walk = { 0 };
+
+  ast_walk_push (&walk, node);
+
+  while (walk.size > 0)
+    {
+      struct ast_frame *frame = ast_walk_top (&walk);
+      uint32_t current = frame->node;
+      uint32_t n = source->children_n[current];
+
+      if (frame->state < n)
+        {
+          ast_walk_push (&walk, ast_child (source, current, frame->state++));
+          continue;
+        }
+
+      uint32_t copy = ast_create (ast, source->type[current],
+                                  source->location[current]);
+
+      if (source->type[current] == AST_ERROR)
+        ast->value[copy].error
+            = diagnostics_add (&ast->errors, *ast_error (source, current));
+      else
+        ast->value[copy] = source->value[current];
 
-  ast = ast_create (AST_ERROR, location, arena);
+      ast->expr_type[copy] = source->expr_type[current];
+      ast->binding[copy] = source->binding[current];
+      ast->state[copy] = source->state[current];
 
-  ast->value.error = error;
+      ast_attach (ast, copy, ast->scratch_size - n);
+      ast_append (ast, copy);
 
-  return ast;
+      ast_walk_pop (&walk);
+    }
+
+  ast_walk_destroy (&walk);
+
+  return ast_pop (ast);
 }
 
-struct ast *
-ast_copy (struct ast *ast, int next, struct arena *arena)
+/* Append all of 'source' to 'ast' and return the index its first node
+   now has. */
+uint32_t
+ast_merge (struct ast *ast, const struct ast *source)
 {
-  if (ast == NULL)
-    return NULL;
+  uint32_t offset = ast->size;
+  uint32_t extra_offset = ast->extra_size;
+  uint32_t n = source->size;
+
+  while (ast->size + n > ast->capacity)
+    ast_grow (ast);
+
+  memcpy (ast->type + offset, source->type, n * sizeof (*ast->type));
+  memcpy (ast->value + offset, source->value, n * sizeof (*ast->value));
+  memcpy (ast->location + offset, source->location,
+          n * sizeof (*ast->location));
+  memcpy (ast->expr_type + offset, source->expr_type,
+          n * sizeof (*ast->expr_type));
+  memcpy (ast->binding + offset, source->binding,
+          n * sizeof (*ast->binding));
+  memcpy (ast->children_n + offset, source->children_n,
+          n * sizeof (*ast->children_n));
+  memcpy (ast->state + offset, source->state, n * sizeof (*ast->state));
+
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      ast->children[offset + i] = source->children[i] + extra_offset;
 
-  struct ast *copy;
+      if (source->type[i] == AST_ERROR)
+        ast->value[offset + i].error
+            = diagnostics_add (&ast->errors, *ast_error (source, i));
+    }
 
-  copy = ast_create (ast->type, ast->location, arena);
+  ast->size += n;
 
-  switch (ast->type)
+  while (ast->extra_size + source->extra_size > ast->extra_capacity)
     {
-    case AST_ERROR:
-      copy->value.error = ast->value.error;
-      break;
-    default:
-      copy->value.token = token_copy (ast->value.token, arena);
-      break;
+      ast->extra_capacity = ast->extra_capacity
+                                ? ast->extra_capacity * 2 : 256;
+      AST_GROW (ast->extra, ast->extra_capacity);
     }
 
-  copy->child = ast_copy (ast->child, 1, arena);
+  for (uint32_t i = 0; i < source->extra_size; ++i)
+    ast->extra[extra_offset + i] = source->extra[i] + offset;
 
-  if (next)
-    copy->next = ast_copy (ast->next, 1, arena);
+  ast->extra_size += source->extra_size;
 
-  return copy;
+  return offset;
 }
 
 void
 ast_destroy (struct ast *ast)
 {
-  if (ast == NULL)
-    return;
+  free (ast->type);
+  free (ast->value);
+  free (ast->location);
+  free (ast->expr_type);
+  free (ast->binding);
+  free (ast->children);
+  free (ast->children_n);
+  free (ast->state);
+  free (ast->extra);
+  free (ast->scratch);
+
+  diagnostics_destroy (&ast->errors);
+
+  *ast = (struct ast){ 0 };
+}
 
-  ast_destroy (ast->child);
-  ast_destroy (ast->next);
+/* Children are collected on a scratch stack while a node is parsed and
+   moved into 'extra' in one piece once it is complete, so appending is
+   O(1). 'ast_mark' remembers where a node's children start. */
+uint32_t
+ast_mark (struct ast *ast)
+{
+  return ast->scratch_size;
+}
 
-  switch (ast->type)
+void
+ast_append (struct ast *ast, uint32_t node)
+{
+  if (ast->scratch_size >= ast->scratch_capacity)
     {
-    case AST_ERROR:
-      break;
-    default:
-      token_destroy (ast->value.token);
-      break;
+      ast->scratch_capacity = ast->scratch_capacity
+                                  ? ast->scratch_capacity * 2 : 64;
+      AST_GROW (ast->scratch, ast->scratch_capacity);
     }
 
-  free (ast);
+  ast->scratch[ast->scratch_size++] = node;
 }
 
-void
-ast_append (struct ast *ast, struct ast *node)
+/* Remove and return the node appended last. */
+uint32_t
+ast_pop (struct ast *ast)
 {
-  if (ast->child == NULL)
-    ast->child = node;
-  else
-    ast_attach (ast->child, node);
+  assert (ast->scratch_size > 0);
+
+  return ast->scratch[--ast->scratch_size];
 }
 
+/* Make everything appended since 'mark' the children of 'node'. */
 void
-ast_attach (struct ast *ast, struct ast *node)
+ast_attach (struct ast *ast, uint32_t node, uint32_t mark)
 {
-  struct ast *current = ast;
+  uint32_t n = ast->scratch_size - mark;
+
+  while (ast->extra_size + n > ast->extra_capacity)
+    {
+      ast->extra_capacity = ast->extra_capacity
+                                ? ast->extra_capacity * 2 : 256;
+      AST_GROW (ast->extra, ast->extra_capacity);
+    }
 
-  while (current->next != NULL)
-    current = current->next;
+  for (uint32_t i = 0; i < n; ++i)
+    ast->extra[ast->extra_size + i] = ast->scratch[mark + i];
 
-  current->next = node;
+  ast->children[node] = ast->extra_size;
+  ast->children_n[node] = n;
+
+  ast->extra_size += n;
+  ast->scratch_size = mark;
+}
+
+uint32_t
+ast_child (const struct ast *ast, uint32_t node, uint32_t i)
+{
+  assert (i < ast->children_n[node]);
+
+  return ast->extra[ast->children[node] + i];
 }
 
 int
-ast_match (struct ast *ast, enum ast_type type)
+ast_match (const struct ast *ast, uint32_t node, enum ast_type type)
 {
-  return ast->type == type;
+  return ast->type[node] == type;
 }
 
 int
-ast_match_error (struct ast *ast)
+ast_match_error (const struct ast *ast, uint32_t node)
 {
-  return ast_match (ast, AST_ERROR);
+  return ast_match (ast, node, AST_ERROR);
 }
 
-#define AST_DEBUG_INDENT 4
+const struct error *
+ast_error (const struct ast *ast, uint32_t node)
+{
+  return &ast->errors.errors[ast->value[node].error];
+}
+
+struct ast_frame *
+ast_walk_push (struct ast_walk *walk, uint32_t node)
+{
+  if (walk->size >= walk->capacity)
+    {
+      walk->capacity = walk->capacity ? walk->capacity * 2 : 64;
+      AST_GROW (walk->frames, walk->capacity);
+    }
+
+  struct ast_frame *frame = &walk->frames[walk->size++];
+
+  *frame = (struct ast_frame){ 0 };
+  frame->node = node;
+
+  return frame;
+}
+
+struct ast_frame *
+ast_walk_top (struct ast_walk *walk)
+{
+  return &walk->frames[walk->size - 1];
+}
+
+void
+ast_walk_pop (struct ast_walk *walk)
+{
+  assert (walk->size > 0);
+
+  walk->size--;
+}
 
 void
-ast_debug_print (struct ast *ast, size_t depth)
+ast_walk_destroy (struct ast_walk *walk)
 {
-  if (ast == NULL)
-    return;
+  free (walk->frames);
+
+  walk->frames = NULL;
+  walk->size = 0;
+  walk->capacity = 0;
+}
 
+#define AST_DEBUG_INDENT 4
+
+static void
+ast_debug_print_node (const struct ast *ast, uint32_t node, size_t depth)
+{
   for (size_t i = depth * AST_DEBUG_INDENT; i--;)
     {
       size_t line = (i % AST_DEBUG_INDENT == (AST_DEBUG_INDENT - 1));
@@ -153,37 +335,56 @@ ast_debug_print (struct ast *ast, size_t depth)
         printf (" ");
     }
 
-  printf ("%s ", ast_type_string (ast->type));
+  printf ("%s ", ast_type_string (ast->type[node]));
 
-  switch (ast->type)
+  switch (ast->type[node])
     {
     case AST_ERROR:
-      printf ("%s", ast->value.error.message);
+      printf ("%s", ast_error (ast, node)->message);
       printf (" ");
       break;
+    case AST_IDENTIFIER:
+      printf ("%s ", ast->value[node].s);
+      break;
+    case AST_NUMBER:
+      printf ("%g ", ast->value[node].f);
+      break;
     default:
-      if (ast->value.token.type != TOKEN_NOTHING)
-        {
-          token_debug_print (ast->value.token);
-          printf (" ");
-        }
       break;
     }
 
-  if (ast->expr_type != NULL)
+  if (ast->expr_type[node] != NULL)
     {
       printf (": ");
-      type_debug_print (ast->expr_type);
+      type_debug_print (ast->expr_type[node]);
     }
 
-  // assert (ast->expr_type != NULL);
-  // printf (": %s", type_kind_string (ast->expr_type->kind));
-
   // printf ("at ");
-  // location_debug_print (ast->location);
+  // location_debug_print (ast->location[node]);
   printf ("\n");
-
-  ast_debug_print (ast->child, depth + 1);
-  ast_debug_print (ast->next, depth);
 }
 
+/* A node's depth below 'node' is its frame's position on the stack. */
+void
+ast_debug_print (const struct ast *ast, uint32_t node, size_t depth)
+{
+  struct ast_walk walk = { 0 };
+
+  ast_walk_push (&walk, node);
+
+  while (walk.size > 0)
+    {
+      struct ast_frame *frame = ast_walk_top (&walk);
+      uint32_t current = frame->node;
+
+      if (frame->state == 0)
+        ast_debug_print_node (ast, current, depth + walk.size - 1);
+
+      if (frame->state < ast->children_n[current])
+        ast_walk_push (&walk, ast_child (ast, current, frame->state++));
+      else
+        ast_walk_pop (&walk);
+    }
+
+  ast_walk_destroy (&walk);
+}
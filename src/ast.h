@@ -1,15 +1,10 @@
 #ifndef AST_H
 #define AST_H
 
-#include "arena.h"
+#include "error.h"
 #include "token.h"
 #include "type.h"
-
-union ast_entry
-{
-  struct error error;
-  struct token token;
-};
+#include <stdint.h>
 
 enum ast_type
 {
@@ -28,32 +23,122 @@ enum ast_type
   AST_PROGRAM,
 };
 
+/* The operator of an AST_BINARY node, kept in its 'state'. */
+enum ast_operator
+{
+  AST_OPERATOR_ASSIGN,
+  AST_OPERATOR_ADD,
+  AST_OPERATOR_SUB,
+  AST_OPERATOR_MUL,
+  AST_OPERATOR_DIV,
+  AST_OPERATOR_LT,
+  AST_OPERATOR_GT,
+  AST_OPERATOR_LE,
+  AST_OPERATOR_GE,
+  /* Defined by the program; 'binding' is its function. */
+  AST_OPERATOR_USER,
+};
+
+/* Flags of an AST_PROTOTYPE node, kept in its 'state'. */
+enum ast_prototype_flag
+{
+  AST_PROTOTYPE_VARIADIC = 1 << 0,
+  /* Annotated 'fast_math' or 'fp_contract': the function's floating-point
+     arithmetic may be reassociated, or only contracted. */
+  AST_PROTOTYPE_FAST_MATH = 1 << 1,
+  AST_PROTOTYPE_FP_CONTRACT = 1 << 2,
+  /* Annotated 'flush_denormals': denormals are read and written as
+     zero. */
+  AST_PROTOTYPE_FLUSH_DENORMALS = 1 << 3,
+};
+
+/* 'binding' of a node whose name does not resolve. */
+#define AST_UNBOUND UINT32_MAX
+
+/* A whole tree, stored as a structure of arrays. A node is a 32-bit index
+   into the per-node arrays, and its children are the run
+   'extra[children[node] .. children[node] + children_n[node])'. */
 struct ast
 {
-  union ast_entry value;
-  enum ast_type type;
-  struct location location;
-  struct type *expr_type;
-  struct ast *child;
-  struct ast *next;
-  int state;
+  uint8_t *type;
+  /* 's' of identifiers, 'f' of numbers, 'error' (into 'errors') of
+     errors. */
+  union token_entry *value;
+  struct location *location;
+  struct type **expr_type;
+  /* Set by name resolution: the variable slot of identifiers, declarations
+     and arguments, the function index of prototypes, calls and
+     user-defined operators. */
+  uint32_t *binding;
+  uint32_t *children;
+  uint32_t *children_n;
+  /* Whether a compound ends in ';', the 'enum ast_prototype_flag's of a
+     prototype, the 'enum ast_operator' of a binary. */
+  uint8_t *state;
+  uint32_t size;
+  uint32_t capacity;
+
+  /* How many variable slots and functions the bindings refer to. */
+  uint32_t variables_n;
+  uint32_t functions_n;
+
+  uint32_t *extra;
+  uint32_t extra_size;
+  uint32_t extra_capacity;
+
+  /* Children collected for nodes still being built, see 'ast_append'. */
+  uint32_t *scratch;
+  uint32_t scratch_size;
+  uint32_t scratch_capacity;
+
+  struct diagnostics errors;
+};
+
+/* A node on the explicit stack of a tree walk. 'state' counts how far the
+   walker got with the node, typically the number of children visited, and
+   'data' is for the walker's own use. */
+struct ast_frame
+{
+  uint32_t node;
+  uint32_t state;
+  void *data[4];
+};
+
+struct ast_walk
+{
+  struct ast_frame *frames;
+  size_t size;
+  size_t capacity;
 };
 
 const char *ast_type_string (enum ast_type);
+const char *ast_operator_string (enum ast_operator);
 
-struct ast *ast_create (enum ast_type, struct location, struct arena *);
-struct ast *ast_create_e (struct error, struct location, struct arena *);
-struct ast *ast_copy (struct ast *, int, struct arena *);
+uint32_t ast_create (struct ast *, enum ast_type, struct location);
+uint32_t ast_create_e (struct ast *, struct error, struct location);
+uint32_t ast_copy (struct ast *, const struct ast *, uint32_t);
+uint32_t ast_merge (struct ast *, const struct ast *);
 
 void ast_destroy (struct ast *);
 
-void ast_append (struct ast *, struct ast *);
-void ast_attach (struct ast *, struct ast *);
+uint32_t ast_mark (struct ast *);
+void ast_append (struct ast *, uint32_t);
+uint32_t ast_pop (struct ast *);
+void ast_attach (struct ast *, uint32_t, uint32_t);
+
+uint32_t ast_child (const struct ast *, uint32_t, uint32_t);
+
+int ast_match (const struct ast *, uint32_t, enum ast_type);
+int ast_match_error (const struct ast *, uint32_t);
+
+const struct error *ast_error (const struct ast *, uint32_t);
 
-int ast_match (struct ast *, enum ast_type);
-int ast_match_error (struct ast *);
+struct ast_frame *ast_walk_push (struct ast_walk *, uint32_t);
+struct ast_frame *ast_walk_top (struct ast_walk *);
+void ast_walk_pop (struct ast_walk *);
+void ast_walk_destroy (struct ast_walk *);
 
-void ast_debug_print (struct ast *, size_t);
+void ast_debug_print (const struct ast *, uint32_t, size_t);
 
 #endif // AST_H
 
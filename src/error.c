@@ -1,19 +1,93 @@
 #include "error.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+static struct file *FILES;
+static size_t files_n;
+static size_t files_capacity;
+
+void
+file_add_line (struct file *file, uint32_t offset)
+{
+  if (file->lines_n >= file->lines_capacity)
+    {
+      file->lines_capacity = file->lines_capacity ? file->lines_capacity * 2
+                                                  : 1024;
+      file->lines = realloc (file->lines,
+                             file->lines_capacity * sizeof (uint32_t));
+    }
+
+  file->lines[file->lines_n++] = offset;
+}
+
+uint32_t
+file_register (struct file file)
+{
+  if (files_n >= files_capacity)
+    {
+      files_capacity = files_capacity ? files_capacity * 2 : 4;
+      FILES = realloc (FILES, files_capacity * sizeof (struct file));
+    }
+
+  FILES[files_n] = file;
+  return files_n++;
+}
+
+void
+file_destroy_all (void)
+{
+  for (size_t i = 0; i < files_n; ++i)
+    free (FILES[i].lines);
+
+  free (FILES);
+
+  FILES = NULL;
+  files_n = 0;
+  files_capacity = 0;
+}
+
+struct location
+location_create (uint32_t file, uint32_t offset)
+{
+  struct location location;
+
+  location.offset = offset;
+  location.file = file;
+
+  return location;
+}
 
 void
-location_advance (struct location *location, char c)
+location_resolve (struct location location, size_t *line, size_t *column)
 {
-  location->column++;
-  if (c == '\n')
-    location->column = 1, location->line++;
+  struct file *file = &FILES[location.file];
+
+  /* Last line starting at or before the offset; 'lines[0]' is 0. */
+  size_t low = 0, high = file->lines_n;
+
+  while (high - low > 1)
+    {
+      size_t middle = low + (high - low) / 2;
+
+      if (file->lines[middle] <= location.offset)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  *line = low + 1;
+  *column = location.offset - file->lines[low] + 1;
 }
 
 void
 location_debug_print (struct location location)
 {
-  printf ("%s:%ld:%ld", location.context, location.line, location.column);
+  size_t line, column;
+
+  location_resolve (location, &line, &column);
+
+  printf ("%s:%ld:%ld", FILES[location.file].context, line, column);
 }
 
 struct error
@@ -29,3 +103,29 @@ error_create (const char *fmt, ...)
   return error;
 }
 
+
+size_t
+diagnostics_add (struct diagnostics *diagnostics, struct error error)
+{
+  if (diagnostics->size >= diagnostics->capacity)
+    {
+      diagnostics->capacity = diagnostics->capacity ? diagnostics->capacity * 2
+                                                    : 4;
+      diagnostics->errors = realloc (diagnostics->errors,
+                                     diagnostics->capacity
+                                         * sizeof (struct error));
+    }
+
+  diagnostics->errors[diagnostics->size] = error;
+  return diagnostics->size++;
+}
+
+void
+diagnostics_destroy (struct diagnostics *diagnostics)
+{
+  free (diagnostics->errors);
+
+  diagnostics->errors = NULL;
+  diagnostics->size = 0;
+  diagnostics->capacity = 0;
+}
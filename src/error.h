@@ -2,12 +2,24 @@
 #define ERROR_H
 
 #include <stddef.h>
+#include <stdint.h>
 
+/* A byte offset into a registered file. Line and column are only worked
+   out from the file's line index when a location is printed. */
 struct location
+{
+  uint32_t offset;
+  uint32_t file;
+};
+
+/* A source file known to diagnostics: its name and the offset at which
+   each of its lines starts. */
+struct file
 {
   const char *context;
-  size_t line;
-  size_t column;
+  uint32_t *lines;
+  size_t lines_n;
+  size_t lines_capacity;
 };
 
 struct error
@@ -17,10 +29,26 @@ struct error
   /* Possible new fields */
 };
 
-void location_advance (struct location *, char);
+/* Errors kept apart from the tokens that refer to them by index. */
+struct diagnostics
+{
+  struct error *errors;
+  size_t size;
+  size_t capacity;
+};
+
+void file_add_line (struct file *, uint32_t);
+uint32_t file_register (struct file);
+void file_destroy_all (void);
+
+struct location location_create (uint32_t, uint32_t);
+void location_resolve (struct location, size_t *, size_t *);
 void location_debug_print (struct location);
 
 struct error error_create (const char *fmt, ...);
 
+size_t diagnostics_add (struct diagnostics *, struct error);
+void diagnostics_destroy (struct diagnostics *);
+
 #endif // ERROR_H
 
@@ -0,0 +1,156 @@
+#include "arena.h"
+#include "intern.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct intern
+{
+  size_t length;
+  unsigned hash;
+  char s[];
+};
+
+/* The table is split into shards by the top bits of the hash, each with
+   its own lock and arena, so lexer threads rarely wait on each other. */
+#define INTERN_SHARDS 64
+
+struct intern_shard
+{
+  pthread_mutex_t lock;
+  struct arena arena;
+  struct intern **table;
+  size_t capacity;
+  size_t n;
+};
+
+static struct intern_shard INTERN_SHARD[INTERN_SHARDS];
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+static void
+intern_init (void)
+{
+  for (size_t i = 0; i < INTERN_SHARDS; ++i)
+    pthread_mutex_init (&INTERN_SHARD[i].lock, NULL);
+}
+
+static struct intern *
+intern_header (const char *s)
+{
+  return (struct intern *)(s - offsetof (struct intern, s));
+}
+
+static unsigned
+intern_hash_n (const char *s, size_t length)
+{
+  unsigned hash = 2166136261u;
+
+  for (size_t i = 0; i < length; ++i)
+    hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+
+  return hash;
+}
+
+static void
+intern_grow (struct intern_shard *shard)
+{
+  size_t capacity = shard->capacity ? shard->capacity * 2 : 64;
+  struct intern **table = calloc (capacity, sizeof (struct intern *));
+
+  for (size_t i = 0; i < shard->capacity; ++i)
+    {
+      struct intern *entry = shard->table[i];
+
+      if (!entry)
+        continue;
+
+      size_t j = entry->hash & (capacity - 1);
+      while (table[j])
+        j = (j + 1) & (capacity - 1);
+
+      table[j] = entry;
+    }
+
+  free (shard->table);
+
+  shard->table = table;
+  shard->capacity = capacity;
+}
+
+static const char *
+intern_find (struct intern_shard *shard, const char *s, size_t length,
+             unsigned hash)
+{
+  if (shard->n * 2 >= shard->capacity)
+    intern_grow (shard);
+
+  size_t mask = shard->capacity - 1;
+  size_t i = hash & mask;
+
+  for (struct intern *entry; (entry = shard->table[i]); i = (i + 1) & mask)
+    if (entry->hash == hash && entry->length == length
+        && memcmp (entry->s, s, length) == 0)
+      return entry->s;
+
+  struct intern *entry;
+
+  entry = arena_alloc (&shard->arena, sizeof (struct intern) + length + 1);
+  entry->length = length;
+  entry->hash = hash;
+  memcpy (entry->s, s, length);
+  entry->s[length] = '\0';
+
+  shard->table[i] = entry;
+  shard->n++;
+
+  return entry->s;
+}
+
+const char *
+intern_n (const char *s, size_t length)
+{
+  pthread_once (&intern_once, intern_init);
+
+  unsigned hash = intern_hash_n (s, length);
+  struct intern_shard *shard = &INTERN_SHARD[hash >> 26];
+
+  pthread_mutex_lock (&shard->lock);
+  const char *result = intern_find (shard, s, length, hash);
+  pthread_mutex_unlock (&shard->lock);
+
+  return result;
+}
+
+const char *
+intern (const char *s)
+{
+  return intern_n (s, strlen (s));
+}
+
+size_t
+intern_length (const char *s)
+{
+  return intern_header (s)->length;
+}
+
+unsigned
+intern_hash (const char *s)
+{
+  return intern_header (s)->hash;
+}
+
+void
+intern_destroy (void)
+{
+  for (size_t i = 0; i < INTERN_SHARDS; ++i)
+    {
+      struct intern_shard *shard = &INTERN_SHARD[i];
+
+      free (shard->table);
+      arena_destroy (&shard->arena);
+
+      shard->table = NULL;
+      shard->capacity = 0;
+      shard->n = 0;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+/* Every distinct spelling is stored once, terminated, with its length and
+   hash kept in front of the characters. Interned strings are equal iff
+   their pointers are equal. */
+
+const char *intern (const char *);
+const char *intern_n (const char *, size_t);
+
+size_t intern_length (const char *);
+unsigned intern_hash (const char *);
+
+void intern_destroy (void);
+
+#endif // INTERN_H
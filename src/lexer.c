@@ -1,39 +1,48 @@
 #include "arena.h"
-#include "string.h"
+#include "intern.h"
 #include "lexer.h"
+#include "number.h"
 #include <ctype.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEXER_BLOCK 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LEXER_BLOCK 16
+#endif
+
 struct lexer
-lexer_create (char *const source, const char *const context,
-              struct arena *arena)
+lexer_create (const char *const source, const char *const context,
+              struct diagnostics *diagnostics)
 {
   struct lexer lexer;
 
+  lexer.source = source;
   lexer.current = source;
-
-  lexer.location.context = context;
-  lexer.location.line = 1;
-  lexer.location.column = 1;
-
-  lexer.arena = arena;
+  lexer.context = context;
+  lexer.diagnostics = diagnostics;
 
   return lexer;
 }
 
+static uint32_t
+lexer_offset (struct lexer *lexer)
+{
+  return lexer->current - lexer->source;
+}
+
 static void
 lexer_advance (struct lexer *lexer)
 {
-  char c = *lexer->current;
-
-  if (c == '\0')
-    return;
-
-  lexer->current++;
-  location_advance (&lexer->location, c);
+  if (*lexer->current != '\0')
+    lexer->current++;
 }
 
 static void
@@ -48,7 +57,7 @@ lexer_advance_token (struct lexer *lexer, size_t type)
 {
   struct token token;
 
-  token = token_create (type, lexer->location);
+  token = token_create (type, lexer_offset (lexer));
 
   lexer_advance (lexer);
 
@@ -60,7 +69,7 @@ lexer_advance_token_n (struct lexer *lexer, size_t n, size_t type)
 {
   struct token token;
 
-  token = token_create (type, lexer->location);
+  token = token_create (type, lexer_offset (lexer));
 
   lexer_advance_n (lexer, n);
 
@@ -72,9 +81,8 @@ lexer_advance_identifier_n (struct lexer *lexer, size_t n)
 {
   struct token token;
 
-  char *s = string_copy_n (lexer->current, n, lexer->arena);
-
-  token = token_create_s (s, TOKEN_IDENTIFIER, lexer->location);
+  token = token_create_s (intern_n (lexer->current, n), TOKEN_IDENTIFIER,
+                          lexer_offset (lexer));
 
   lexer_advance_n (lexer, n);
 
@@ -88,123 +96,83 @@ lexer_match (struct lexer *lexer, const char *s)
   return strncmp (lexer->current, s, length) == 0;
 }
 
-static int
-lexer_is_digit_base (char c, int base)
-{
-  switch (base)
-    {
-    case 2:
-      return c == '0' || c == '1';
-    case 8:
-      return c >= '0' && c <= '7';
-    case 16:
-      return isxdigit (c);
-    }
-
-  return 0;
-}
-
-static struct token
-lexer_lex_number_base (struct lexer *lexer, int base)
-{
-  struct location location = lexer->location;
-  const char *start = lexer->current;
-
-  while (lexer_is_digit_base (*lexer->current, base))
-    lexer_advance (lexer);
-
-  int i = strtol (start, NULL, base);
-
-  return token_create_f ((double)i, TOKEN_NUMBER, location);
-}
-
 static struct token
 lexer_lex_number (struct lexer *lexer)
 {
-  if (*lexer->current == '0')
-    switch (*(lexer->current + 1))
-      {
-      case 'b':
-      case 'B':
-        lexer_advance_n (lexer, 2);
-        return lexer_lex_number_base (lexer, 2);
-      case 'o':
-      case 'O':
-        lexer_advance_n (lexer, 2);
-        return lexer_lex_number_base (lexer, 8);
-      case 'x':
-      case 'X':
-        lexer_advance_n (lexer, 2);
-        return lexer_lex_number_base (lexer, 16);
-      }
-
-  struct location location = lexer->location;
-  const char *start = lexer->current;
+  uint32_t offset = lexer_offset (lexer);
+  double f;
 
-  while (isdigit (*lexer->current))
-    lexer_advance (lexer);
+  const char *end = number_parse (lexer->current, &f);
 
-  if (*lexer->current == '.')
+  if (!end)
     {
-      lexer_advance (lexer);
+      struct error error = error_create ("malformed number literal");
 
-      while (isdigit (*lexer->current))
-        lexer_advance (lexer);
+      return token_create_e (diagnostics_add (lexer->diagnostics, error),
+                             offset);
     }
 
-  if (*lexer->current == 'e' || *lexer->current == 'E')
-    {
-      lexer_advance (lexer);
+  lexer->current = end;
 
-      if (*lexer->current == '+' || *lexer->current == '-')
-        lexer_advance (lexer);
+  return token_create_f (f, TOKEN_NUMBER, offset);
+}
 
-      while (isdigit (*lexer->current))
-        lexer_advance (lexer);
-    }
+struct keyword
+{
+  const char *s;
+  size_t length;
+  enum token_type type;
+};
+
+/* Perfect hash over the keyword set: KEYWORD_HASH picks a distinct slot for
+   every keyword, so a lookup is one hash, one length check and at most one
+   'memcmp'. A new keyword goes into the slot its hash names; if that slot is
+   taken, change the hash until the set is collision-free again. */
+#define KEYWORD_HASH(s, n)                                                   \
+  (((unsigned char)(s)[0] + (unsigned char)(s)[(n) - 1] + (n)) & 31)
+
+static const struct keyword KEYWORD_TABLE[32] = {
+  [1] = { "while", 5, TOKEN_WHILE },
+  [6] = { "then", 4, TOKEN_THEN },
+  [14] = { "else", 4, TOKEN_ELSE },
+  [17] = { "if", 2, TOKEN_IF },
+  [18] = { "Bool", 4, TOKEN_BOOL },
+  [21] = { "do", 2, TOKEN_DO },
+  [22] = { "as", 2, TOKEN_AS },
+  [29] = { "F64", 3, TOKEN_F64 },
+  [30] = { "Void", 4, TOKEN_VOID },
+  // [15] = { "define", 6, TOKEN_DEFINE },
+  // [25] = { "extern", 6, TOKEN_EXTERN },
+};
+
+static enum token_type
+lexer_keyword (const char *s, size_t n)
+{
+  const struct keyword *keyword = &KEYWORD_TABLE[KEYWORD_HASH (s, n)];
 
-  double f = strtod (start, NULL);
+  if (keyword->length == n && memcmp (keyword->s, s, n) == 0)
+    return keyword->type;
 
-  return token_create_f (f, TOKEN_NUMBER, location);
+  return TOKEN_IDENTIFIER;
 }
 
 static struct token
 lexer_lex_identifier (struct lexer *lexer)
 {
-  struct location location = lexer->location;
+  uint32_t offset = lexer_offset (lexer);
   const char *start = lexer->current;
 
   while (isalnum (*lexer->current) || *lexer->current == '_'
          || *lexer->current == '\'')
     lexer_advance (lexer);
 
-  // if (strncmp (start, "define", 6) == 0)
-  //   return token_create (TOKEN_DEFINE, location);
-  // if (strncmp (start, "extern", 6) == 0)
-  //   return token_create (TOKEN_EXTERN, location);
-
-  if (strncmp (start, "if", 2) == 0)
-    return token_create (TOKEN_IF, location);
-  if (strncmp (start, "then", 4) == 0)
-    return token_create (TOKEN_THEN, location);
-  if (strncmp (start, "else", 4) == 0)
-    return token_create (TOKEN_ELSE, location);
-  if (strncmp (start, "Void", 4) == 0)
-    return token_create (TOKEN_VOID, location);
-  if (strncmp (start, "F64", 3) == 0)
-    return token_create (TOKEN_F64, location);
-  if (strncmp (start, "Bool", 4) == 0)
-    return token_create (TOKEN_BOOL, location);
-  if (strncmp (start, "as", 2) == 0)
-    return token_create (TOKEN_AS, location);
-  if (strncmp (start, "while", 5) == 0)
-    return token_create (TOKEN_WHILE, location);
-  if (strncmp (start, "do", 2) == 0)
-    return token_create (TOKEN_DO, location);
-
-  char *s = string_copy_until (start, lexer->current, lexer->arena);
-
-  return token_create_s (s, TOKEN_IDENTIFIER, location);
+  enum token_type type = lexer_keyword (start, lexer->current - start);
+  if (type != TOKEN_IDENTIFIER)
+    return token_create (type, offset);
+
+  const char *s = intern_n (start, lexer->current - start);
+
+  return token_create_s (s, TOKEN_IDENTIFIER, offset);
 }
 
 static int
@@ -229,31 +197,184 @@ lexer_valid_punct (char c)
 static struct token
 lexer_lex_operator (struct lexer *lexer)
 {
-  struct location location = lexer->location;
+  uint32_t offset = lexer_offset (lexer);
   const char *start = lexer->current;
 
   while (lexer_valid_punct (*lexer->current))
     lexer_advance (lexer);
 
-  char *s = string_copy_until (start, lexer->current, lexer->arena);
+  /* A lone '.' is no operator, and an empty token would be lexed again
+     forever. */
+  if (lexer->current == start)
+    {
+      struct error error = error_create ("unexpected character %c", *start);
 
-  return token_create_s (s, TOKEN_IDENTIFIER, location);
+      return token_create_e (diagnostics_add (lexer->diagnostics, error),
+                             offset);
+    }
+
+  const char *s = intern_n (start, lexer->current - start);
+
+  return token_create_s (s, TOKEN_IDENTIFIER, offset);
 }
 
-struct token
-lexer_next (struct lexer *lexer)
+#ifdef LEXER_BLOCK
+
+#define LEXER_BLOCK_MASK ((uint32_t)(((uint64_t)1 << LEXER_BLOCK) - 1))
+
+/* Classify one aligned block. Bit 'i' of each mask describes 'block[i]'.
+   Aligned loads never cross a page boundary, so reading the rest of the
+   block that holds the terminating '\0' is safe. */
+static void
+lexer_block_scan (const char *block, uint32_t *space, uint32_t *newline,
+                  uint32_t *zero)
 {
-  while (isspace (*lexer->current))
-    lexer_advance (lexer);
+#if defined(__AVX2__)
+  __m256i b = _mm256_load_si256 ((const __m256i *)block);
+
+  __m256i nl = _mm256_cmpeq_epi8 (b, _mm256_set1_epi8 ('\n'));
+  __m256i sp = _mm256_cmpeq_epi8 (b, _mm256_set1_epi8 (' '));
+  __m256i ws = _mm256_and_si256 (_mm256_cmpgt_epi8 (b, _mm256_set1_epi8 (8)),
+                                 _mm256_cmpgt_epi8 (_mm256_set1_epi8 (14), b));
+  __m256i z = _mm256_cmpeq_epi8 (b, _mm256_setzero_si256 ());
+
+  *space = _mm256_movemask_epi8 (_mm256_or_si256 (sp, ws));
+  *newline = _mm256_movemask_epi8 (nl);
+  *zero = _mm256_movemask_epi8 (z);
+#else
+  __m128i b = _mm_load_si128 ((const __m128i *)block);
+
+  /* '\t' '\n' '\v' '\f' '\r' are the contiguous range 9..13. */
+  __m128i nl = _mm_cmpeq_epi8 (b, _mm_set1_epi8 ('\n'));
+  __m128i sp = _mm_cmpeq_epi8 (b, _mm_set1_epi8 (' '));
+  __m128i ws = _mm_and_si128 (_mm_cmpgt_epi8 (b, _mm_set1_epi8 (8)),
+                              _mm_cmplt_epi8 (b, _mm_set1_epi8 (14)));
+  __m128i z = _mm_cmpeq_epi8 (b, _mm_setzero_si128 ());
+
+  *space = _mm_movemask_epi8 (_mm_or_si128 (sp, ws));
+  *newline = _mm_movemask_epi8 (nl);
+  *zero = _mm_movemask_epi8 (z);
+#endif
+}
+
+/* Skip whitespace starting at 'p'. */
+static const char *
+lexer_scan_space (const char *p)
+{
+  uintptr_t offset = (uintptr_t)p & (LEXER_BLOCK - 1);
+  const char *block = p - offset;
+  uint32_t space, newline, zero;
+
+  lexer_block_scan (block, &space, &newline, &zero);
+  space |= ((uint32_t)1 << offset) - 1;
+
+  while (space == LEXER_BLOCK_MASK)
+    {
+      block += LEXER_BLOCK;
+      lexer_block_scan (block, &space, &newline, &zero);
+    }
+
+  return block + __builtin_ctz (~space);
+}
+
+/* Skip to the '\n' or '\0' that ends the comment line at 'p'. */
+static const char *
+lexer_scan_line (const char *p)
+{
+  uintptr_t offset = (uintptr_t)p & (LEXER_BLOCK - 1);
+  const char *block = p - offset;
+  uint32_t space, newline, zero;
+
+  lexer_block_scan (block, &space, &newline, &zero);
+
+  uint32_t stop = (newline | zero) & ~(((uint32_t)1 << offset) - 1);
+
+  while (!stop)
+    {
+      block += LEXER_BLOCK;
+      lexer_block_scan (block, &space, &newline, &zero);
+      stop = newline | zero;
+    }
+
+  return block + __builtin_ctz (stop);
+}
+
+static void
+lexer_lines (struct file *file, const char *source)
+{
+  uintptr_t offset = (uintptr_t)source & (LEXER_BLOCK - 1);
+  const char *block = source - offset;
+  uint32_t space, newline, zero;
+
+  lexer_block_scan (block, &space, &newline, &zero);
+  newline &= ~(((uint32_t)1 << offset) - 1);
+  zero &= ~(((uint32_t)1 << offset) - 1);
 
-  while (*lexer->current == '#')
+  while (1)
     {
-      while (*lexer->current && *lexer->current != '\n')
-        lexer_advance (lexer);
+      if (zero)
+        newline &= ((uint32_t)1 << __builtin_ctz (zero)) - 1;
+
+      while (newline)
+        {
+          const char *p = block + __builtin_ctz (newline) + 1;
+          file_add_line (file, p - source);
+          newline &= newline - 1;
+        }
+
+      if (zero)
+        return;
 
-      while (isspace (*lexer->current))
-        lexer_advance (lexer);
+      block += LEXER_BLOCK;
+      lexer_block_scan (block, &space, &newline, &zero);
     }
+}
+
+#else
+
+static const char *
+lexer_scan_space (const char *p)
+{
+  while (isspace (*p))
+    p++;
+
+  return p;
+}
+
+static const char *
+lexer_scan_line (const char *p)
+{
+  while (*p && *p != '\n')
+    p++;
+
+  return p;
+}
+
+static void
+lexer_lines (struct file *file, const char *source)
+{
+  for (const char *p = source; *p; ++p)
+    if (*p == '\n')
+      file_add_line (file, p + 1 - source);
+}
+
+#endif
+
+static void
+lexer_skip (struct lexer *lexer)
+{
+  const char *p = lexer_scan_space (lexer->current);
+
+  while (*p == '#')
+    p = lexer_scan_space (lexer_scan_line (p));
+
+  lexer->current = p;
+}
+
+struct token
+lexer_next (struct lexer *lexer)
+{
+  lexer_skip (lexer);
 
   char c = *lexer->current;
 
@@ -323,7 +444,7 @@ lexer_next (struct lexer *lexer)
       return lexer_advance_identifier_n (lexer, 1);
     */
     case '\0':
-      return token_create (TOKEN_NOTHING, lexer->location);
+      return token_create (TOKEN_NOTHING, lexer_offset (lexer));
     }
 
   if (isdigit (c))
@@ -335,14 +456,185 @@ lexer_next (struct lexer *lexer)
   if (ispunct (c))
     return lexer_lex_operator (lexer);
 
-  return token_create_e (error_create ("unexpected character %c", c),
-                         lexer->location);
+  struct error error = error_create ("unexpected character %c", c);
+
+  return token_create_e (diagnostics_add (lexer->diagnostics, error),
+                         lexer_offset (lexer));
 }
 
-struct token
-lexer_peek (struct lexer *lexer)
+static void
+lexer_register (struct lexer *lexer, struct token_stream *stream)
+{
+  struct file file = { 0 };
+
+  file.context = lexer->context;
+  file_add_line (&file, 0);
+  lexer_lines (&file, lexer->source);
+
+  stream->file = file_register (file);
+  stream->diagnostics = lexer->diagnostics;
+}
+
+/* Lex tokens starting before offset 'end'. A token at or past 'end'
+   belongs to the next chunk and is dropped. */
+static void
+lexer_tokenize_until (struct lexer *lexer, uint32_t end,
+                      struct token_stream *stream)
 {
-  struct lexer copy = *lexer;
-  return lexer_next (&copy);
+  stream->size = 0;
+  stream->capacity = 1024;
+  stream->tokens = malloc (stream->capacity * sizeof (struct token));
+
+  while (1)
+    {
+      if (stream->size >= stream->capacity)
+        {
+          stream->capacity *= 2;
+          stream->tokens = realloc (stream->tokens,
+                                    stream->capacity * sizeof (struct token));
+        }
+
+      struct token token = lexer_next (lexer);
+
+      if (token.offset >= end)
+        break;
+
+      stream->tokens[stream->size++] = token;
+
+      if (token_match (token, TOKEN_NOTHING) || token_match_error (token))
+        break;
+    }
 }
 
+void
+lexer_tokenize (struct lexer *lexer, struct token_stream *stream)
+{
+  lexer_register (lexer, stream);
+  lexer_tokenize_until (lexer, UINT32_MAX, stream);
+}
+
+/* Chunks smaller than this are not worth a thread. */
+#define LEXER_CHUNK_MIN (1 << 20)
+
+struct lexer_chunk
+{
+  struct lexer lexer;
+  uint32_t end;
+  struct token_stream stream;
+  struct diagnostics diagnostics;
+  pthread_t thread;
+};
+
+static void *
+lexer_chunk_run (void *data)
+{
+  struct lexer_chunk *chunk = data;
+
+  lexer_tokenize_until (&chunk->lexer, chunk->end, &chunk->stream);
+  return NULL;
+}
+
+void
+lexer_tokenize_parallel (struct lexer *lexer, size_t size, size_t threads,
+                         struct token_stream *stream)
+{
+  if (threads > size / LEXER_CHUNK_MIN)
+    threads = size / LEXER_CHUNK_MIN;
+
+  if (threads <= 1)
+    {
+      lexer_tokenize (lexer, stream);
+      return;
+    }
+
+  lexer_register (lexer, stream);
+
+  /* No token or comment contains a newline, so every line start is a
+     point where lexing can begin without any context. */
+  struct lexer_chunk *chunks = calloc (threads, sizeof (struct lexer_chunk));
+  size_t n = 0;
+  uint32_t start = 0;
+
+  for (size_t i = 1; i <= threads; ++i)
+    {
+      uint32_t end = UINT32_MAX;
+
+      if (i < threads)
+        {
+          const char *p = memchr (lexer->source + size / threads * i, '\n',
+                                  size - size / threads * i);
+          if (!p)
+            continue;
+
+          end = p + 1 - lexer->source;
+          if (end <= start)
+            continue;
+        }
+
+      struct lexer_chunk *chunk = &chunks[n++];
+
+      chunk->lexer = *lexer;
+      chunk->lexer.current = lexer->source + start;
+      chunk->lexer.diagnostics = &chunk->diagnostics;
+      chunk->end = end;
+
+      start = end;
+      if (end == UINT32_MAX)
+        break;
+    }
+
+  for (size_t i = 1; i < n; ++i)
+    pthread_create (&chunks[i].thread, NULL, lexer_chunk_run, &chunks[i]);
+
+  lexer_chunk_run (&chunks[0]);
+
+  for (size_t i = 1; i < n; ++i)
+    pthread_join (chunks[i].thread, NULL);
+
+  size_t total = 0;
+  for (size_t i = 0; i < n; ++i)
+    total += chunks[i].stream.size;
+
+  stream->tokens = malloc (total * sizeof (struct token));
+  stream->size = 0;
+  stream->capacity = total;
+
+  /* Concatenate in source order; the stream ends at the first error. */
+  for (size_t i = 0; i < n; ++i)
+    {
+      struct lexer_chunk *chunk = &chunks[i];
+      struct token *tokens = chunk->stream.tokens;
+      size_t size = chunk->stream.size;
+
+      memcpy (stream->tokens + stream->size, tokens,
+              size * sizeof (struct token));
+      stream->size += size;
+
+      if (size && token_match_error (tokens[size - 1]))
+        {
+          struct token *last = &stream->tokens[stream->size - 1];
+          struct error error = chunk->diagnostics.errors[last->value.error];
+
+          last->value.error = diagnostics_add (lexer->diagnostics, error);
+          break;
+        }
+    }
+
+  for (size_t i = 0; i < n; ++i)
+    {
+      token_stream_destroy (&chunks[i].stream);
+      diagnostics_destroy (&chunks[i].diagnostics);
+    }
+
+  free (chunks);
+}
+
+void
+token_stream_destroy (struct token_stream *stream)
+{
+  free (stream->tokens);
+
+  stream->tokens = NULL;
+  stream->size = 0;
+  stream->capacity = 0;
+}
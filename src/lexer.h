@@ -2,17 +2,38 @@
 #define LEXER_H
 
 #include "token.h"
+#include <stdint.h>
 
 struct lexer
 {
-  char *current;
-  struct location location;
-  struct arena *arena;
+  const char *source;
+  const char *current;
+  const char *context;
+  struct diagnostics *diagnostics;
 };
 
-struct lexer lexer_create (char *const, const char *const, struct arena *);
+/* Every token of a source, in order. The last token is always
+   TOKEN_NOTHING or the TOKEN_ERROR that stopped lexing. Token offsets are
+   relative to 'file', which 'lexer_tokenize' registers. */
+struct token_stream
+{
+  struct token *tokens;
+  size_t size;
+  size_t capacity;
+
+  uint32_t file;
+  struct diagnostics *diagnostics;
+};
+
+struct lexer lexer_create (const char *const, const char *const,
+                           struct diagnostics *);
 struct token lexer_next (struct lexer *);
-struct token lexer_peek (struct lexer *);
+
+void lexer_tokenize (struct lexer *, struct token_stream *);
+void lexer_tokenize_parallel (struct lexer *, size_t, size_t,
+                              struct token_stream *);
+void token_stream_destroy (struct token_stream *);
+
 
 #endif // LEXER_H
 
@@ -1,53 +1,43 @@
 #include <stdio.h>
 
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <libgen.h>
 #include <limits.h>
+#include <unistd.h>
 
 #include "arena.h"
 #include "ast.h"
 #include "error.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
+#include "source.h"
 #include "string.h"
+#include "target.h"
 #include "token.h"
 #include "type.h"
 
-static char *
-read_file (const char *filename)
-{
-  FILE *file = fopen (filename, "r");
-
-  fseek (file, 0, SEEK_END);
-  size_t file_size = ftell (file);
-  fseek (file, 0, SEEK_SET);
-
-  char *buffer = (char *)malloc (file_size + 1);
-  (void)fread (buffer, 1, file_size, file);
-
-  buffer[file_size] = '\0';
-
-  fclose (file);
-  return buffer;
-}
-
 #include <llvm-c/Core.h>
+#include <llvm-c/Error.h>
 #include <llvm-c/ExecutionEngine.h>
 #include <llvm-c/Target.h>
 #include <llvm-c/Analysis.h>
+#include <llvm-c/IRReader.h>
+#include <llvm-c/Linker.h>
 #include <llvm-c/Support.h>
 
-#include <llvm-c/Transforms/Scalar.h>
-#include <llvm-c/Transforms/PassManagerBuilder.h>
-#include <llvm-c//Transforms/Utils.h>
+#include <llvm-c/Transforms/PassBuilder.h>
 
 int has_error = 0;
 
 LLVMContextRef context;
 LLVMModuleRef module;
 LLVMBuilderRef builder;
-LLVMPassManagerRef pass_manager;
 
 LLVMValueRef
 generate_error (struct location location, const char *fmt)
@@ -78,157 +68,416 @@ type_kind_to_llvm (enum type_kind kind)
 
 enum symbol_type
 {
-  SYMBOL_TYPE,
-  SYMBOL_VALUE,
-};
-
-union symbol_value
-{
-  struct type *type;
-  LLVMValueRef value;
+  SYMBOL_NONE,
+  SYMBOL_VARIABLE,
+  SYMBOL_FUNCTION,
 };
 
+/* 'index' is the variable slot or function index the name binds to, see
+   'ast_resolve'. */
 struct symbol
 {
-  union symbol_value value;
-  char *name;
+  const char *name;
   enum symbol_type type;
+  uint32_t index;
 };
 
-struct symbol *
-symbol_create (enum symbol_type type, const char *name)
+/* All bindings of a namespace live in one open-addressing table keyed by
+   interned name, holding the innermost binding of each name. Adding a
+   binding saves the one it shadows in an undo log, and leaving a block
+   restores everything logged since it was entered, so nested blocks cost
+   nothing to enter and lookups are a single probe sequence. Names stay in
+   the table once added; an unbound name has type SYMBOL_NONE. */
+struct scope
 {
-  struct symbol *symbol;
-
-  symbol = calloc (1, sizeof (struct symbol));
-
-  symbol->type = type;
-  symbol->name = string_copy (name, NULL);
+  struct symbol *table;
+  size_t capacity;
+  size_t n;
+
+  struct symbol *undo;
+  size_t undo_n;
+  size_t undo_capacity;
+
+  /* Length of 'undo' when each open block was entered. */
+  size_t *marks;
+  size_t marks_n;
+  size_t marks_capacity;
+};
 
-  return symbol;
+struct scope *
+scope_create (void)
+{
+  return calloc (1, sizeof (struct scope));
 }
 
 void
-symbol_destroy (struct symbol *symbol)
+scope_destroy (struct scope *scope)
 {
-  free (symbol->name);
-  free (symbol);
+  free (scope->table);
+  free (scope->undo);
+  free (scope->marks);
+  free (scope);
 }
 
-struct scope
+static struct symbol *
+scope_slot (struct scope *scope, const char *name)
 {
-  struct scope *parent;
-  struct symbol **table;
-  size_t table_capacity;
-  size_t table_n;
-};
+  size_t mask = scope->capacity - 1;
+  size_t i = intern_hash (name) & mask;
 
-struct scope *
-scope_create (struct scope *parent)
-{
-  struct scope *scope;
+  while (scope->table[i].name && scope->table[i].name != name)
+    i = (i + 1) & mask;
+
+  return &scope->table[i];
+}
 
-  scope = calloc (1, sizeof (struct scope));
+static void
+scope_grow (struct scope *scope)
+{
+  struct symbol *table = scope->table;
+  size_t capacity = scope->capacity;
 
-  scope->parent = parent;
-  scope->table_capacity = 4;
-  scope->table_n = 0;
+  scope->capacity = capacity ? capacity * 2 : 64;
+  scope->table = calloc (scope->capacity, sizeof (struct symbol));
 
-  scope->table = calloc (scope->table_capacity, sizeof (struct symbol *));
+  for (size_t i = 0; i < capacity; ++i)
+    if (table[i].name)
+      *scope_slot (scope, table[i].name) = table[i];
 
-  return scope;
+  free (table);
 }
 
-void
-scope_clear (struct scope *scope)
+struct symbol *
+scope_find (struct scope *scope, const char *name)
 {
-  for (size_t i = 0; i < scope->table_n; ++i)
-    symbol_destroy (scope->table[i]);
-  scope->table_n = 0;
+  if (scope->capacity == 0)
+    return NULL;
+
+  struct symbol *symbol = scope_slot (scope, name);
+
+  if (symbol->type == SYMBOL_NONE)
+    return NULL;
+
+  return symbol;
 }
 
-void
-scope_destroy (struct scope *scope)
+/* Bind 'name' in the innermost block, shadowing any outer binding, and
+   return the binding for the caller to fill in. The pointer is only valid
+   until the next 'scope_add'. */
+struct symbol *
+scope_add (struct scope *scope, enum symbol_type type, const char *name)
 {
-  scope_clear (scope);
-  free (scope->table);
-  free (scope);
+  if (scope->n * 2 >= scope->capacity)
+    scope_grow (scope);
+
+  struct symbol *symbol = scope_slot (scope, name);
+
+  if (!symbol->name)
+    {
+      symbol->name = name;
+      scope->n++;
+    }
+
+  if (scope->undo_n >= scope->undo_capacity)
+    {
+      scope->undo_capacity = scope->undo_capacity
+                                 ? scope->undo_capacity * 2 : 64;
+      scope->undo = realloc (scope->undo,
+                             scope->undo_capacity * sizeof (struct symbol));
+    }
+
+  scope->undo[scope->undo_n++] = *symbol;
+
+  symbol->type = type;
+  symbol->index = 0;
+
+  return symbol;
 }
 
 void
-scope_add (struct scope *scope, struct symbol *symbol)
+scope_enter (struct scope *scope)
 {
-  if (scope->table_n >= scope->table_capacity)
+  if (scope->marks_n >= scope->marks_capacity)
     {
-      scope->table_capacity *= 2.0;
-      scope->table = realloc (scope->table,
-                              scope->table_capacity * sizeof (struct symbol *));
+      scope->marks_capacity = scope->marks_capacity
+                                  ? scope->marks_capacity * 2 : 16;
+      scope->marks = realloc (scope->marks,
+                              scope->marks_capacity * sizeof (size_t));
     }
 
-  scope->table[scope->table_n++] = symbol;
+  scope->marks[scope->marks_n++] = scope->undo_n;
 }
 
-struct symbol *
-scope_find (struct scope *scope, const char *name)
+static void
+scope_undo (struct scope *scope, size_t mark)
 {
-  for (size_t i = 0; i < scope->table_n; ++i)
-    if (strcmp (scope->table[i]->name, name) == 0)
-      return scope->table[i];
+  while (scope->undo_n > mark)
+    {
+      struct symbol *old = &scope->undo[--scope->undo_n];
+
+      *scope_slot (scope, old->name) = *old;
+    }
+}
 
-  if (scope->parent)
-    return scope_find (scope->parent, name);
+/* Drop every binding made since the matching 'scope_enter'. */
+void
+scope_leave (struct scope *scope)
+{
+  scope_undo (scope, scope->marks[--scope->marks_n]);
+}
 
-  return NULL;
+/* Drop every binding and open block. */
+void
+scope_clear (struct scope *scope)
+{
+  scope_undo (scope, 0);
+  scope->marks_n = 0;
 }
 
-LLVMValueRef
-create_entry_alloca(LLVMValueRef function, const char *name, LLVMTypeRef type)
+/* A variable slot with one or two values of it. */
+struct generate_write
 {
-  LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(function);
-  LLVMValueRef first_instr = LLVMGetFirstInstruction(entry);
+  uint32_t slot;
+  LLVMValueRef value;
+  LLVMValueRef other;
+};
 
-  LLVMBasicBlockRef curr_bb = LLVMGetInsertBlock(builder);
+/* What 'ast_effects' proves about the function of an index. */
+enum ast_effect
+{
+  /* Calls nothing but pure functions of the program, so it touches no
+     memory and cannot unwind. */
+  AST_EFFECT_PURE = 1 << 0,
+  /* Pure and on no cycle of calls. */
+  AST_EFFECT_NORECURSE = 1 << 1,
+  /* Pure, and neither it nor anything it calls loops or recurses. */
+  AST_EFFECT_WILLRETURN = 1 << 2,
+};
 
-  if (first_instr)
-    LLVMPositionBuilderBefore(builder, first_instr);
-  else
-    LLVMPositionBuilderAtEnd(builder, entry); // fallback if entry is empty
+/* Floating-point semantics of a function's arithmetic. */
+enum generate_fp
+{
+  GENERATE_FP_STRICT,
+  /* 'a * b + c' may be fused. */
+  GENERATE_FP_CONTRACT,
+  /* Also reassociated, and assumed free of NaNs, infinities and signed
+     zeros. */
+  GENERATE_FP_FAST,
+};
+
+/* The C API cannot put fast-math flags on an instruction, so relaxed
+   arithmetic calls one of these instead. They carry the flags and are
+   inlined by every pipeline, as the always-inliner runs even at '-O0'.
+
+   Inlining keeps a '*-fp-math' attribute of the caller only where the
+   callee has it too, so the fast helpers carry the ones
+   'generate_fp_attributes' gives fast functions. */
+#define GENERATE_FP_HELPER(mode, op, attributes)                              \
+  "define double @fp." mode "." op "(double %a, double %b) alwaysinline"      \
+  attributes " {\n"                                                          \
+  "  %r = " op " " mode " double %a, %b\n"                                   \
+  "  ret double %r\n"                                                        \
+  "}\n"
+
+#define GENERATE_FP_HELPERS(mode, attributes)                                 \
+  GENERATE_FP_HELPER (mode, "fadd", attributes)                               \
+  GENERATE_FP_HELPER (mode, "fsub", attributes)                               \
+  GENERATE_FP_HELPER (mode, "fmul", attributes)                               \
+  GENERATE_FP_HELPER (mode, "fdiv", attributes)
+
+static const char GENERATE_FP_SOURCE[]
+    = GENERATE_FP_HELPERS ("contract", "")
+        GENERATE_FP_HELPERS ("fast", " \"unsafe-fp-math\"=\"true\""
+                                     " \"no-infs-fp-math\"=\"true\""
+                                     " \"no-nans-fp-math\"=\"true\""
+                                     " \"no-signed-zeros-fp-math\"=\"true\""
+                                     " \"approx-func-fp-math\"=\"true\"");
+
+/* Named as in GENERATE_FP_SOURCE, by mode and then by operator from
+   AST_OPERATOR_ADD on. */
+static const char *const GENERATE_FP_NAME[2][4] = {
+  { "fp.contract.fadd", "fp.contract.fsub", "fp.contract.fmul",
+    "fp.contract.fdiv" },
+  { "fp.fast.fadd", "fp.fast.fsub", "fp.fast.fmul", "fp.fast.fdiv" },
+};
 
-  LLVMValueRef alloca = LLVMBuildAlloca(builder, type, name);
+/* Code generation walks the tree with an explicit stack. The step
+   function of a node runs each time control comes back to it: it either
+   pushes the next child to generate, or pops the node and leaves its result
+   in 'value'.
+
+   Variables are never stored to memory; the IR is built in SSA form as it
+   is generated. 'variables' holds the value each variable slot has at the
+   point being generated. Since the only control flow is 'if' and 'while',
+   phis are only needed where those join:
+
+   - Both branches of a conditional log what they write and are undone
+     once generated, so each starts from the values before the
+     conditional. The merge block gets a phi for every variable declared
+     outside that the branches left with different values.
+
+   - A loop's condition block, its header, gets a phi for every variable
+     the loop assigns, found by scanning the loop up front. The header is
+     sealed once the body is generated, by adding the values the body
+     ends with as the phis' second incoming edge. */
+struct generator
+{
+  struct ast *ast;
+  struct ast_walk walk;
+  LLVMValueRef value;
 
-  LLVMPositionBuilderAtEnd(builder, curr_bb);
+  /* Indexed by the bindings of the tree: the current value of each
+     variable slot and the function of each function index. */
+  LLVMValueRef *variables;
+  LLVMValueRef *functions;
+
+  /* Slots below this were declared before the point being generated. */
+  uint32_t declared;
+
+  /* Writes to 'variables' made inside conditional branches, logged with
+     the value they replaced, while 'branches' is not zero. */
+  struct generate_write *writes;
+  size_t writes_n;
+  size_t writes_capacity;
+  uint32_t branches;
+
+  /* Values a conditional's branches ended with and the phis of a loop's
+     header, innermost construct last. */
+  struct generate_write *joins;
+  size_t joins_n;
+  size_t joins_capacity;
+
+  /* Where each open conditional or loop starts in 'writes' and 'joins'. */
+  size_t *marks;
+  size_t marks_n;
+  size_t marks_capacity;
+
+  /* Per-slot stamps, to visit each slot once when collecting writes. */
+  uint32_t *seen;
+  uint32_t epoch;
+
+  /* Scratch walk for scanning loops. */
+  struct ast_walk scan;
+
+  /* Arguments of the calls being generated, innermost last. */
+  LLVMValueRef *arguments;
+  size_t arguments_n;
+  size_t arguments_capacity;
+
+  /* What '-ffast-math' and '-ffp-contract' ask for, and what the function
+     being generated uses, which its annotations may relax further. */
+  enum generate_fp fp;
+  enum generate_fp fp_function;
+  /* '-fdenormal-fp-math=preserve-sign'. */
+  int flush;
+
+  /* The helpers of GENERATE_FP_SOURCE, linked in when first needed. */
+  LLVMValueRef fp_helpers[2][4];
+  int fp_linked;
+
+  /* The 'enum ast_effect's of each function index. */
+  const uint8_t *effects;
+};
 
-  return alloca;
+#define GENERATE_GROW(array, size, capacity)                                  \
+  do                                                                          \
+    if ((size) >= (capacity))                                                 \
+      {                                                                       \
+        (capacity) = (capacity) ? (capacity) * 2 : 64;                        \
+        (array) = realloc ((array), (capacity) * sizeof (*(array)));          \
+      }                                                                       \
+  while (0)
+
+static void
+generate_push (struct generator *generator, uint32_t node)
+{
+  ast_walk_push (&generator->walk, node);
 }
 
-/*
-LLVMValueRef
-create_entry_alloca2 (LLVMValueRef function, const char *name, LLVMTypeRef type)
+static void
+generate_return (struct generator *generator, LLVMValueRef value)
 {
-  LLVMBasicBlockRef entryBlock = LLVMGetEntryBasicBlock (function);
+  generator->value = value;
+  ast_walk_pop (&generator->walk);
+}
 
-  LLVMBuilderRef new_builder = LLVMCreateBuilder ();
+static void
+generate_mark (struct generator *generator, size_t mark)
+{
+  GENERATE_GROW (generator->marks, generator->marks_n,
+                 generator->marks_capacity);
+  generator->marks[generator->marks_n++] = mark;
+}
 
-  LLVMPositionBuilderAtEnd (new_builder, entryBlock);
+static size_t
+generate_unmark (struct generator *generator)
+{
+  return generator->marks[--generator->marks_n];
+}
 
-  LLVMValueRef allocaInst = LLVMBuildAlloca (new_builder, type, name);
+static void
+generate_join_add (struct generator *generator, uint32_t slot,
+                   LLVMValueRef value, LLVMValueRef other)
+{
+  GENERATE_GROW (generator->joins, generator->joins_n,
+                 generator->joins_capacity);
+  generator->joins[generator->joins_n++]
+      = (struct generate_write){ slot, value, other };
+}
 
-  LLVMDisposeBuilder (new_builder);
+/* Give 'slot' the value 'value' from here on. */
+static void
+generate_write (struct generator *generator, uint32_t slot,
+                LLVMValueRef value)
+{
+  if (generator->branches > 0)
+    {
+      GENERATE_GROW (generator->writes, generator->writes_n,
+                     generator->writes_capacity);
+      generator->writes[generator->writes_n++] = (struct generate_write){
+        slot, generator->variables[slot], NULL
+      };
+    }
 
-  return allocaInst;
+  generator->variables[slot] = value;
 }
-*/
 
-LLVMValueRef generate (struct ast *node, struct scope *scope);
+static void
+generate_declare (struct generator *generator, uint32_t slot,
+                  LLVMValueRef value)
+{
+  if (slot >= generator->declared)
+    generator->declared = slot + 1;
 
-LLVMValueRef
-generate_cast (struct ast *node, struct scope *scope)
+  generate_write (generator, slot, value);
+}
+
+/* Undo the writes since 'mark'. Every slot below 'declared' they wrote is
+   added to the joins once, with the value it had before undoing. */
+static void
+generate_undo (struct generator *generator, size_t mark, uint32_t declared)
 {
-  enum type_kind t1 = node->child->expr_type->kind;
-  enum type_kind t2 = node->expr_type->kind;
+  generator->epoch++;
 
-  LLVMValueRef v = generate (node->child, scope);
+  while (generator->writes_n > mark)
+    {
+      struct generate_write write = generator->writes[--generator->writes_n];
+
+      if (write.slot < declared
+          && generator->seen[write.slot] != generator->epoch)
+        {
+          generator->seen[write.slot] = generator->epoch;
+          generate_join_add (generator, write.slot,
+                             generator->variables[write.slot], NULL);
+        }
 
+      generator->variables[write.slot] = write.value;
+    }
+}
+
+LLVMValueRef
+generate_cast_value (enum type_kind t1, enum type_kind t2, LLVMValueRef v)
+{
   // printf ("'%s' to '%s'\n",
   //         type_kind_string (t1),
   //         type_kind_string (t2));
@@ -256,788 +505,2197 @@ generate_cast (struct ast *node, struct scope *scope)
   return v;
 }
 
-LLVMValueRef
-generate_identifier (struct ast *node, struct scope *scope)
+void
+generate_cast (struct generator *generator, struct ast_frame *frame)
 {
-  const char *name = node->value.token.value.s;
-  struct symbol *symbol = scope_find (scope, name);
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
 
-  if (!symbol)
-    return generate_error (node->location, "undefined-variable");
+  if (frame->state++ == 0)
+    {
+      generate_push (generator, ast_child (ast, node, 0));
+      return;
+    }
 
-  LLVMValueRef value = symbol->value.value;
+  enum type_kind t1 = ast->expr_type[ast_child (ast, node, 0)]->kind;
+  enum type_kind t2 = ast->expr_type[node]->kind;
 
-  LLVMTypeRef t = LLVMGetElementType (LLVMTypeOf (value));
-  LLVMValueRef v = LLVMBuildLoad2 (builder, t, value, name);
+  generate_return (generator,
+                   generate_cast_value (t1, t2, generator->value));
+}
 
-  return v;
+LLVMValueRef
+generate_identifier (struct generator *generator, uint32_t node)
+{
+  struct ast *ast = generator->ast;
+
+  if (ast->binding[node] == AST_UNBOUND)
+    return generate_error (ast->location[node], "undefined-variable");
+
+  return generator->variables[ast->binding[node]];
 }
 
 LLVMValueRef
-generate_number (struct ast *node, struct scope *scope)
+generate_number (struct ast *ast, uint32_t node)
 {
   return LLVMConstReal (LLVMDoubleTypeInContext (context),
-                        node->value.token.value.f);
+                        ast->value[node].f);
 }
 
-LLVMValueRef
-generate_binary (struct ast *node, struct scope *scope)
+static void
+generate_fp_link (struct generator *generator)
 {
-  // LLVMTypeRef type = LLVMDoubleTypeInContext (context);
+  LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRange (
+      GENERATE_FP_SOURCE, sizeof (GENERATE_FP_SOURCE) - 1, "fp", 0);
+  LLVMModuleRef helpers;
+  char *error;
 
-  const char *operator = node->child->value.token.value.s;
+  if (LLVMParseIRInContext (context, buffer, &helpers, &error) != 0)
+    {
+      fprintf (stderr, "Error parsing floating-point helpers: %s\n", error);
+      LLVMDisposeMessage (error);
+      exit (1);
+    }
 
-  if (strcmp (operator, "=") == 0)
+  if (LLVMLinkModules2 (module, helpers) != 0)
     {
-      struct symbol *symbol =
-        scope_find (scope, node->child->next->value.token.value.s);
+      fprintf (stderr, "Error linking floating-point helpers\n");
+      exit (1);
+    }
 
-      LLVMValueRef var = symbol->value.value;
+  for (size_t i = 0; i < 2; ++i)
+    for (size_t j = 0; j < 4; ++j)
+      {
+        LLVMValueRef helper = LLVMGetNamedFunction (module,
+                                                    GENERATE_FP_NAME[i][j]);
+        LLVMSetLinkage (helper, LLVMInternalLinkage);
+        generator->fp_helpers[i][j] = helper;
+      }
 
-      LLVMValueRef right = generate (node->child->next->next, scope);
-      LLVMBuildStore (builder, right, var);
-      return right;
-    }
+  generator->fp_linked = 1;
+}
+
+/* Arithmetic 'operator' of the current function's semantics. */
+static LLVMValueRef
+generate_fp (struct generator *generator, enum ast_operator operator,
+             LLVMValueRef left, LLVMValueRef right)
+{
+  if (generator->fp_function == GENERATE_FP_STRICT)
+    switch (operator)
+      {
+      case AST_OPERATOR_ADD:
+        return LLVMBuildFAdd (builder, left, right, "");
+      case AST_OPERATOR_SUB:
+        return LLVMBuildFSub (builder, left, right, "");
+      case AST_OPERATOR_MUL:
+        return LLVMBuildFMul (builder, left, right, "");
+      default:
+        return LLVMBuildFDiv (builder, left, right, "");
+      }
+
+  if (!generator->fp_linked)
+    generate_fp_link (generator);
+
+  LLVMValueRef helper = generator->fp_helpers[generator->fp_function - 1]
+                                             [operator - AST_OPERATOR_ADD];
+  LLVMValueRef arguments[2] = { left, right };
+
+  return LLVMBuildCall2 (builder, LLVMGetElementType (LLVMTypeOf (helper)),
+                         helper, arguments, 2, "");
+}
+
+/* The attributes of what 'ast_effects' proved about 'function'. */
+static void
+generate_effects (LLVMValueRef function, uint8_t effects)
+{
+  static const struct
+  {
+    const char *name;
+    uint8_t effect;
+  } attributes[] = {
+    { "readnone", AST_EFFECT_PURE },
+    { "nounwind", AST_EFFECT_PURE },
+    { "nofree", AST_EFFECT_PURE },
+    { "nosync", AST_EFFECT_PURE },
+    { "norecurse", AST_EFFECT_NORECURSE },
+    { "willreturn", AST_EFFECT_WILLRETURN },
+  };
+
+  for (size_t i = 0; i < sizeof (attributes) / sizeof (*attributes); ++i)
+    if (effects & attributes[i].effect)
+      {
+        const char *name = attributes[i].name;
+        unsigned kind = LLVMGetEnumAttributeKindForName (name, strlen (name));
+
+        LLVMAddAttributeAtIndex (function, LLVMAttributeFunctionIndex,
+                                 LLVMCreateEnumAttribute (context, kind, 0));
+      }
+}
+
+/* The attributes code generation reads for fast-math functions. */
+static void
+generate_fp_attributes (LLVMValueRef function)
+{
+  static const char *const names[] = {
+    "unsafe-fp-math",          "no-infs-fp-math",     "no-nans-fp-math",
+    "no-signed-zeros-fp-math", "approx-func-fp-math",
+  };
+
+  for (size_t i = 0; i < sizeof (names) / sizeof (*names); ++i)
+    LLVMAddAttributeAtIndex (
+        function, LLVMAttributeFunctionIndex,
+        LLVMCreateStringAttribute (context, names[i], strlen (names[i]),
+                                   "true", 4));
+}
 
-  LLVMValueRef left = generate (node->child->next, scope);
-  LLVMValueRef right = generate (node->child->next->next, scope);
+LLVMValueRef
+generate_binary_value (struct generator *generator, uint32_t node,
+                       LLVMValueRef left, LLVMValueRef right)
+{
+  struct ast *ast = generator->ast;
 
   if (!left || !right)
     return NULL;
 
-  if (strcmp (operator, "+") == 0)
-    return LLVMBuildFAdd (builder, left, right, "");
+  switch (ast->state[node])
+    {
+    case AST_OPERATOR_ADD:
+    case AST_OPERATOR_SUB:
+    case AST_OPERATOR_MUL:
+    case AST_OPERATOR_DIV:
+      return generate_fp (generator, ast->state[node], left, right);
+    case AST_OPERATOR_LT:
+      return LLVMBuildFCmp (builder, LLVMRealOLT, left, right, "");
+    case AST_OPERATOR_GT:
+      return LLVMBuildFCmp (builder, LLVMRealOGT, left, right, "");
+    case AST_OPERATOR_LE:
+      return LLVMBuildFCmp (builder, LLVMRealOLE, left, right, "");
+    case AST_OPERATOR_GE:
+      return LLVMBuildFCmp (builder, LLVMRealOGE, left, right, "");
+    default:
+      break;
+    }
+
+  if (ast->binding[node] == AST_UNBOUND)
+    return generate_error (ast->location[node], "undefined operator-function");
+
+  LLVMValueRef function = generator->functions[ast->binding[node]];
+
+  LLVMValueRef arguments[2] = { left, right };
+
+  LLVMTypeRef function_type = LLVMGetElementType(LLVMTypeOf(function));
 
-  if (strcmp (operator, "-") == 0)
-    return LLVMBuildFSub (builder, left, right, "");
+  LLVMValueRef call = LLVMBuildCall2 (builder, function_type, function,
+                                      arguments, 2, "");
+  return call;
+}
 
-  if (strcmp (operator, "*") == 0)
-    return LLVMBuildFMul (builder, left, right, "");
+void
+generate_binary (struct generator *generator, struct ast_frame *frame)
+{
+  // LLVMTypeRef type = LLVMDoubleTypeInContext (context);
 
-  if (strcmp (operator, "/") == 0)
-    return LLVMBuildFDiv (builder, left, right, "");
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+  uint32_t state = frame->state++;
 
-  if (strcmp (operator, "<") == 0)
+  if (ast->state[node] == AST_OPERATOR_ASSIGN)
     {
-      return LLVMBuildFCmp (builder, LLVMRealOLT, left, right, "");
+      if (state == 0)
+        {
+          generate_push (generator, ast_child (ast, node, 2));
+          return;
+        }
+
+      LLVMValueRef right = generator->value;
+      generate_write (generator, ast->binding[ast_child (ast, node, 1)],
+                      right);
+      generate_return (generator, right);
+      return;
     }
 
-  if (strcmp (operator, ">") == 0)
+  /* Left operand, then right operand. */
+  if (state < 2)
     {
-      return LLVMBuildFCmp (builder, LLVMRealOGT, left, right, "");
+      if (state == 1)
+        frame->data[1] = generator->value;
+
+      generate_push (generator, ast_child (ast, node, state + 1));
+      return;
     }
 
-  if (strcmp (operator, "<=") == 0)
+  generate_return (generator, generate_binary_value (generator, node,
+                                                     frame->data[1],
+                                                     generator->value));
+}
+
+/* Called at the start of the merge block of a conditional, once both
+   branches were undone. 'joins' holds what the then branch ended with from
+   'mark' on, and the else branch's writes since 'writes' are still in the
+   log. Every slot either branch wrote gets the value of the branch control
+   came from. */
+static void
+generate_merge (struct generator *generator, size_t mark, size_t writes,
+                uint32_t declared, LLVMBasicBlockRef then_block,
+                LLVMBasicBlockRef else_block)
+{
+  LLVMValueRef *variables = generator->variables;
+
+  generator->epoch++;
+
+  /* What the else branch ended with, or the value from before. */
+  for (size_t i = mark; i < generator->joins_n; ++i)
     {
-      return LLVMBuildFCmp (builder, LLVMRealOLE, left, right, "");
+      struct generate_write *join = &generator->joins[i];
+
+      generator->seen[join->slot] = generator->epoch;
+      join->other = variables[join->slot];
     }
 
-  if (strcmp (operator, ">=") == 0)
+  /* Slots only the else branch wrote had their value from before in the
+     then branch. */
+  for (size_t i = writes; i < generator->writes_n; ++i)
     {
-      return LLVMBuildFCmp (builder, LLVMRealOGE, left, right, "");
+      struct generate_write write = generator->writes[i];
+
+      if (write.slot < declared
+          && generator->seen[write.slot] != generator->epoch)
+        {
+          generator->seen[write.slot] = generator->epoch;
+          generate_join_add (generator, write.slot, write.value,
+                             variables[write.slot]);
+        }
     }
 
-  LLVMValueRef function = LLVMGetNamedFunction (module, operator);
-  if (!function)
-    return generate_error (node->location, "undefined operator-function");
+  generator->branches--;
 
-  LLVMValueRef arguments[2] = { left, right };
+  while (generator->writes_n > writes)
+    {
+      struct generate_write write = generator->writes[--generator->writes_n];
+      variables[write.slot] = write.value;
+    }
 
-  LLVMTypeRef function_type = LLVMGetElementType(LLVMTypeOf(function));
+  for (size_t i = mark; i < generator->joins_n; ++i)
+    {
+      struct generate_write join = generator->joins[i];
+      LLVMValueRef value = join.value;
 
-  LLVMValueRef call = LLVMBuildCall2 (builder, function_type, function,
-                                      arguments, 2, "");
-  return call;
+      if (join.value != join.other)
+        {
+          value = LLVMBuildPhi (builder, LLVMTypeOf (join.value), "");
+          LLVMAddIncoming (value, &join.value, &then_block, 1);
+          LLVMAddIncoming (value, &join.other, &else_block, 1);
+        }
+
+      generate_write (generator, join.slot, value);
+    }
+
+  generator->joins_n = mark;
 }
 
-LLVMValueRef
-generate_conditional (struct ast *node, struct scope *scope)
+void
+generate_conditional (struct generator *generator, struct ast_frame *frame)
 {
-  LLVMValueRef cond_v = generate (node->child, scope);
-  if (!cond_v)
-    return NULL;
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+
+  /* 'data' holds the merge block, then the else block, which is replaced
+     by the value and end of the then branch once that is done. Marks hold
+     the slots declared before, where the branches' writes start and, once
+     the then branch is done, where its joins start. */
+  switch (frame->state++)
+    {
+    case 0:
+      generate_push (generator, ast_child (ast, node, 0));
+      return;
+    case 1:
+      {
+        LLVMValueRef cond_v = generator->value;
+        if (!cond_v)
+          {
+            generate_return (generator, NULL);
+            return;
+          }
 
-  LLVMTypeRef result_type = type_kind_to_llvm (node->expr_type->kind);
+        LLVMBasicBlockRef current_bb = LLVMGetInsertBlock (builder);
+        LLVMValueRef fn = LLVMGetBasicBlockParent (current_bb);
 
-  LLVMBasicBlockRef current_bb = LLVMGetInsertBlock (builder);
-  LLVMValueRef fn = LLVMGetBasicBlockParent (current_bb);
+        LLVMBasicBlockRef trueBlock = LLVMAppendBasicBlock(fn, "if.true");
+        LLVMBasicBlockRef falseBlock = LLVMAppendBasicBlock(fn, "if.false");
+        LLVMBasicBlockRef mergeBlock = LLVMAppendBasicBlock(fn, "if.merge");
 
-  LLVMBasicBlockRef trueBlock = LLVMAppendBasicBlock(fn, "if.true");
-  LLVMBasicBlockRef falseBlock = LLVMAppendBasicBlock(fn, "if.false");
-  LLVMBasicBlockRef mergeBlock = LLVMAppendBasicBlock(fn, "if.merge");
+        LLVMBuildCondBr(builder, cond_v, trueBlock, falseBlock);
 
-  LLVMBuildCondBr(builder, cond_v, trueBlock, falseBlock);
+        LLVMPositionBuilderAtEnd(builder, trueBlock);
 
-  LLVMPositionBuilderAtEnd(builder, trueBlock);
-  LLVMValueRef valTrue = generate (node->child->next, scope);
-  LLVMBuildBr(builder, mergeBlock);
-  trueBlock = LLVMGetInsertBlock (builder);
+        frame->data[1] = mergeBlock;
+        frame->data[2] = falseBlock;
+
+        generate_mark (generator, generator->declared);
+        generate_mark (generator, generator->writes_n);
+        generator->branches++;
+
+        generate_push (generator, ast_child (ast, node, 1));
+        return;
+      }
+    case 2:
+      {
+        LLVMBasicBlockRef mergeBlock = frame->data[1];
+        LLVMBasicBlockRef falseBlock = frame->data[2];
+
+        LLVMBuildBr(builder, mergeBlock);
+
+        frame->data[2] = generator->value;
+        frame->data[3] = LLVMGetInsertBlock (builder);
+
+        size_t writes = generator->marks[generator->marks_n - 1];
+        uint32_t declared = generator->marks[generator->marks_n - 2];
+
+        generate_mark (generator, generator->joins_n);
+        generate_undo (generator, writes, declared);
+
+        LLVMPositionBuilderAtEnd(builder, falseBlock);
 
-  LLVMPositionBuilderAtEnd(builder, falseBlock);
-  LLVMValueRef valFalse = generate (node->child->next->next, scope);
+        generate_push (generator, ast_child (ast, node, 2));
+        return;
+      }
+    }
+
+  LLVMTypeRef result_type = type_kind_to_llvm (ast->expr_type[node]->kind);
+
+  LLVMBasicBlockRef mergeBlock = frame->data[1];
+  LLVMValueRef valTrue = frame->data[2];
+  LLVMBasicBlockRef trueBlock = frame->data[3];
+
+  LLVMValueRef valFalse = generator->value;
   LLVMBuildBr(builder, mergeBlock);
-  falseBlock = LLVMGetInsertBlock (builder);
+  LLVMBasicBlockRef falseBlock = LLVMGetInsertBlock (builder);
 
   LLVMPositionBuilderAtEnd(builder, mergeBlock);
+
+  size_t mark = generate_unmark (generator);
+  size_t writes = generate_unmark (generator);
+  uint32_t declared = generate_unmark (generator);
+
+  generate_merge (generator, mark, writes, declared, trueBlock, falseBlock);
+
   if (LLVMGetTypeKind(result_type) == LLVMVoidTypeKind)
     {
-      return NULL;
+      generate_return (generator, NULL);
     }
   else
     {
       LLVMValueRef phi = LLVMBuildPhi(builder, result_type, "iftmp");
       LLVMAddIncoming(phi, &valTrue, &trueBlock, 1);
       LLVMAddIncoming(phi, &valFalse, &falseBlock, 1);
-      return phi;
+      generate_return (generator, phi);
     }
+}
 
+void
+generate_compound (struct generator *generator, struct ast_frame *frame)
+{
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+  uint32_t state = frame->state++;
 
-  /*
-  LLVMPositionBuilderAtEnd(builder, mergeBlock);
-  LLVMValueRef phi = LLVMBuildPhi(builder, result_type, "iftmp");
-
-  LLVMAddIncoming(phi, &valTrue, &trueBlock, 1);
-  LLVMAddIncoming(phi, &valFalse, &falseBlock, 1);
+  if (state < ast->children_n[node])
+    {
+      generate_push (generator, ast_child (ast, node, state));
+      return;
+    }
 
-  return phi;
-  */
+  generate_return (generator, state ? generator->value : NULL);
 }
 
-LLVMValueRef
-generate_compound (struct ast *node, struct scope *scope)
+/* Called at the start of the header of loop 'node', entered from
+   'preheader'. Adds a phi for every slot declared before the loop that the
+   loop assigns, and for every variable the loop declares without a value,
+   which keeps its value from the iteration before. The phis are added to
+   the joins. */
+static void
+generate_loop (struct generator *generator, uint32_t node,
+               LLVMBasicBlockRef preheader)
 {
-  struct ast *current = node->child;
+  struct ast *ast = generator->ast;
+  struct ast_walk *walk = &generator->scan;
+  size_t mark = generator->joins_n;
 
-  struct scope *child = scope_create (scope);
+  generator->epoch++;
 
-  LLVMValueRef result;
+  walk->size = 0;
+  ast_walk_push (walk, node);
 
-  while (current)
+  while (walk->size > 0)
     {
-      result = generate (current, child);
-      current = current->next;
-    }
+      struct ast_frame *frame = ast_walk_top (walk);
+      uint32_t current = frame->node;
+
+      if (frame->state < ast->children_n[current])
+        {
+          ast_walk_push (walk, ast_child (ast, current, frame->state++));
+          continue;
+        }
+
+      ast_walk_pop (walk);
+
+      uint32_t slot = AST_UNBOUND;
+      struct type *type = ast->expr_type[current];
+
+      if (ast_match (ast, current, AST_BINARY)
+          && ast->state[current] == AST_OPERATOR_ASSIGN)
+        {
+          uint32_t variable = ast_child (ast, current, 1);
+
+          slot = ast->binding[variable];
+          type = ast->expr_type[variable];
+
+          if (slot >= generator->declared)
+            slot = AST_UNBOUND;
+        }
+
+      if (ast_match (ast, current, AST_DECLARATION)
+          && ast->children_n[current] == 1)
+        slot = ast->binding[current];
+
+      if (slot == AST_UNBOUND || generator->seen[slot] == generator->epoch)
+        continue;
+
+      generator->seen[slot] = generator->epoch;
+
+      LLVMTypeRef llvm_type = type_kind_to_llvm (type->kind);
+      LLVMValueRef value = generator->variables[slot];
+
+      if (!value)
+        value = LLVMGetUndef (llvm_type);
+
+      LLVMValueRef phi = LLVMBuildPhi (builder, llvm_type, "");
+      LLVMAddIncoming (phi, &value, &preheader, 1);
+
+      generate_join_add (generator, slot, phi, NULL);
+    }
+
+  for (size_t i = mark; i < generator->joins_n; ++i)
+    generate_write (generator, generator->joins[i].slot,
+                    generator->joins[i].value);
+}
+
+void
+generate_while (struct generator *generator, struct ast_frame *frame)
+{
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+
+  switch (frame->state++)
+    {
+    case 0:
+      {
+        LLVMBasicBlockRef current_bb = LLVMGetInsertBlock (builder);
+        LLVMValueRef fn = LLVMGetBasicBlockParent (current_bb);
+
+        LLVMBasicBlockRef condBlock = LLVMAppendBasicBlock (fn, "while.cond");
+        LLVMBasicBlockRef bodyBlock = LLVMAppendBasicBlock (fn, "while.body");
+        LLVMBasicBlockRef endBlock  = LLVMAppendBasicBlock (fn, "while.end");
+
+        LLVMBuildBr (builder, condBlock);
+
+        LLVMPositionBuilderAtEnd (builder, condBlock);
+
+        frame->data[1] = condBlock;
+        frame->data[2] = bodyBlock;
+        frame->data[3] = endBlock;
+
+        generate_mark (generator, generator->joins_n);
+        generate_loop (generator, node, current_bb);
+
+        generate_push (generator, ast_child (ast, node, 0));
+        return;
+      }
+    case 1:
+      {
+        LLVMValueRef condVal = generator->value;
+        if (!condVal)
+          {
+            generator->joins_n = generate_unmark (generator);
+            generate_return (generator, NULL);
+            return;
+          }
+
+        /* The values the loop exits with. */
+        size_t mark = generator->marks[generator->marks_n - 1];
+        for (size_t i = mark; i < generator->joins_n; ++i)
+          generator->joins[i].other
+              = generator->variables[generator->joins[i].slot];
+
+        LLVMBuildCondBr (builder, condVal, frame->data[2], frame->data[3]);
+
+        LLVMPositionBuilderAtEnd (builder, frame->data[2]);
+
+        generate_push (generator, ast_child (ast, node, 1));
+        return;
+      }
+    }
+
+  size_t mark = generate_unmark (generator);
+
+  LLVMValueRef bodyVal = generator->value;
+  if (!bodyVal)
+    {
+      generator->joins_n = mark;
+      generate_return (generator, NULL);
+      return;
+    }
+
+  /* Seal the header. */
+  LLVMBasicBlockRef latch = LLVMGetInsertBlock (builder);
+
+  for (size_t i = mark; i < generator->joins_n; ++i)
+    {
+      struct generate_write join = generator->joins[i];
+
+      LLVMAddIncoming (join.value, &generator->variables[join.slot], &latch,
+                       1);
+      generate_write (generator, join.slot, join.other);
+    }
+
+  generator->joins_n = mark;
+
+  LLVMBuildBr(builder, frame->data[1]);
+
+  LLVMPositionBuilderAtEnd (builder, frame->data[3]);
+
+  generate_return (generator, LLVMConstNull(LLVMDoubleType()));
+}
+
+void
+generate_declaration (struct generator *generator, struct ast_frame *frame)
+{
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+  uint32_t state = frame->state++;
+
+  uint32_t slot = ast->binding[node];
+
+  if (state == 0 && ast->children_n[node] > 1)
+    {
+      generate_push (generator, ast_child (ast, node, 1));
+      return;
+    }
+
+  /* Without a value, a variable in a loop keeps the one it had at the end
+     of the iteration before, see 'generate_loop'. */
+  LLVMValueRef value = generator->variables[slot];
+
+  if (state == 1)
+    value = generator->value;
+  else if (!value)
+    value = LLVMGetUndef (type_kind_to_llvm (ast->expr_type[node]->kind));
+
+  generate_declare (generator, slot, value);
+
+  generate_return (generator, value);
+}
+
+void
+generate_call (struct generator *generator, struct ast_frame *frame)
+{
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+  uint32_t state = frame->state++;
+
+  size_t n = ast->children_n[node] - 1;
+
+  if (state == 0)
+    {
+      LLVMValueRef function = NULL;
+
+      if (ast->binding[node] != AST_UNBOUND)
+        function = generator->functions[ast->binding[node]];
+
+      if (!function)
+        {
+          generate_return (generator, generate_error (ast->location[node],
+                                                      "undefined-function"));
+          return;
+          // printf ("undefined function '%s'\n", name);
+          // return NULL;
+        }
+
+      LLVMTypeRef type = LLVMGetElementType(LLVMTypeOf(function));
+      int variadic = LLVMIsFunctionVarArg (type);
+
+      size_t params = LLVMCountParams (function);
+      if ((!variadic && n != params) || (variadic && n < params))
+        {
+          generate_return (generator, generate_error (ast->location[node],
+                                                      "argument # mismatch"));
+          return;
+        }
+        // {
+        //   fprintf (stderr, "\n");
+        //   return NULL;
+        // }
+
+      frame->data[1] = function;
+    }
+  else
+    {
+      if (!generator->value)
+        {
+          generator->arguments_n -= state - 1;
+          generate_return (generator, NULL);
+          return;
+        }
+
+      if (generator->arguments_n >= generator->arguments_capacity)
+        {
+          generator->arguments_capacity = generator->arguments_capacity
+                                              ? generator->arguments_capacity * 2
+                                              : 16;
+          generator->arguments = realloc (generator->arguments,
+                                          generator->arguments_capacity
+                                              * sizeof (LLVMValueRef));
+        }
+
+      generator->arguments[generator->arguments_n++] = generator->value;
+    }
+
+  if (state < n)
+    {
+      generate_push (generator, ast_child (ast, node, state + 1));
+      return;
+    }
+
+  LLVMValueRef function = frame->data[1];
+  LLVMTypeRef type = LLVMGetElementType(LLVMTypeOf(function));
+
+  generator->arguments_n -= n;
+
+  LLVMValueRef call = LLVMBuildCall2 (builder, type, function,
+                                      generator->arguments
+                                          + generator->arguments_n,
+                                      n, "");
+  generate_return (generator, call);
+}
+
+/* Every prototype adds a function; calls use the first one of its name. */
+LLVMValueRef
+generate_prototype (struct generator *generator, uint32_t node)
+{
+  struct ast *ast = generator->ast;
+  const char *name = ast->value[ast_child (ast, node, 0)].s;
+
+  size_t n = ast->children_n[node] - 1;
+
+  struct type_function t_func = ast->expr_type[node]->value.function;
+
+  LLVMTypeRef arguments[n];
+  for (size_t i = 0; i < n; ++i)
+    {
+      arguments[i] = type_kind_to_llvm (t_func.argument_t[i]->kind);
+      // arguments[i] = // LLVMDoubleTypeInContext (context);
+    }
+
+  LLVMTypeRef type = LLVMFunctionType (type_kind_to_llvm (t_func.return_t->kind),
+                                       arguments, n,
+                                       ast->state[node]
+                                           & AST_PROTOTYPE_VARIADIC);
+
+  LLVMValueRef function = LLVMAddFunction(module, name, type);
+
+  LLVMValueRef argument = LLVMGetFirstParam (function);
+
+  for (size_t i = 0; argument != NULL && i < n; ++i)
+    {
+      LLVMSetValueName (argument, ast->value[ast_child (ast, node, i + 1)].s);
+      argument = LLVMGetNextParam (argument);
+    }
+
+  if (!generator->functions[ast->binding[node]])
+    generator->functions[ast->binding[node]] = function;
+
+  return function;
+}
+
+void
+generate_function (struct generator *generator, struct ast_frame *frame)
+{
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+
+  uint32_t prototype = ast_child (ast, node, 0);
+
+  if (frame->state++ == 0)
+    {
+      LLVMValueRef function = generator->functions[ast->binding[prototype]];
+
+      if (!function)
+        function = generate_prototype (generator, prototype);
+
+      if (!function)
+        {
+          generate_return (generator, NULL);
+          return;
+        }
+
+      generator->fp_function = generator->fp;
+
+      if (ast->state[prototype] & AST_PROTOTYPE_FP_CONTRACT
+          && generator->fp_function < GENERATE_FP_CONTRACT)
+        generator->fp_function = GENERATE_FP_CONTRACT;
+
+      if (ast->state[prototype] & AST_PROTOTYPE_FAST_MATH)
+        generator->fp_function = GENERATE_FP_FAST;
+
+      if (generator->fp_function == GENERATE_FP_FAST)
+        generate_fp_attributes (function);
+
+      generate_effects (function,
+                        generator->effects[ast->binding[prototype]]);
+
+      if (generator->flush
+          || ast->state[prototype] & AST_PROTOTYPE_FLUSH_DENORMALS)
+        LLVMAddAttributeAtIndex (
+            function, LLVMAttributeFunctionIndex,
+            LLVMCreateStringAttribute (context, "denormal-fp-math", 16,
+                                       "preserve-sign,preserve-sign", 27));
+
+      LLVMBasicBlockRef bb = LLVMAppendBasicBlockInContext (context, function,
+                                                            "entry");
+      LLVMPositionBuilderAtEnd (builder, bb);
+
+      size_t n = 0;
+
+      for (LLVMValueRef argument = LLVMGetFirstParam (function); argument != NULL;
+           argument = LLVMGetNextParam (argument), ++n)
+        {
+          uint32_t current = ast_child (ast, prototype, n + 1);
+
+          generate_declare (generator, ast->binding[current], argument);
+        }
+
+      frame->data[1] = function;
+
+      generate_push (generator, ast_child (ast, node, 1));
+      return;
+    }
+
+  LLVMValueRef function = frame->data[1];
+  LLVMValueRef returnV = generator->value;
+
+  if (ast->expr_type[prototype]->value.function.return_t->kind != TYPE_VOID)
+    LLVMBuildRet (builder, returnV);
+  else
+    LLVMBuildRetVoid (builder);
+
+  generate_return (generator, function);
+}
+
+void
+generate_program (struct generator *generator, struct ast_frame *frame)
+{
+  struct ast *ast = generator->ast;
+  uint32_t node = frame->node;
+
+  if (frame->state < ast->children_n[node])
+    {
+      uint32_t child = ast_child (ast, node, frame->state++);
+
+      generate_push (generator, child);
+      return;
+    }
+
+  generate_return (generator, NULL);
+}
+
+LLVMValueRef
+generate (struct ast *ast, uint32_t root, const uint8_t *effects,
+          enum generate_fp fp, int flush)
+{
+  struct generator generator = { 0 };
+
+  generator.ast = ast;
+  generator.effects = effects;
+  generator.fp = fp;
+  generator.flush = flush;
+  generator.variables = calloc (ast->variables_n + 1, sizeof (LLVMValueRef));
+  generator.functions = calloc (ast->functions_n + 1, sizeof (LLVMValueRef));
+  generator.seen = calloc (ast->variables_n + 1, sizeof (uint32_t));
+  generate_push (&generator, root);
+
+  while (generator.walk.size > 0)
+    {
+      struct ast_frame *frame = ast_walk_top (&generator.walk);
+      uint32_t node = frame->node;
+
+      switch (ast->type[node])
+        {
+        case AST_ERROR:
+          generate_return (&generator, NULL);
+          break;
+        case AST_CAST:
+          generate_cast (&generator, frame);
+          break;
+        case AST_IDENTIFIER:
+          generate_return (&generator, generate_identifier (&generator, node));
+          break;
+        case AST_NUMBER:
+          generate_return (&generator, generate_number (ast, node));
+          break;
+        case AST_BINARY:
+          generate_binary (&generator, frame);
+          break;
+        case AST_CONDITIONAL:
+          generate_conditional (&generator, frame);
+          break;
+        case AST_COMPOUND:
+          generate_compound (&generator, frame);
+          break;
+        case AST_WHILE:
+          generate_while (&generator, frame);
+          break;
+        case AST_DECLARATION:
+          generate_declaration (&generator, frame);
+          break;
+        case AST_CALL:
+          generate_call (&generator, frame);
+          break;
+        case AST_PROTOTYPE:
+          generate_return (&generator, generate_prototype (&generator, node));
+          break;
+        case AST_FUNCTION:
+          generate_function (&generator, frame);
+          break;
+        case AST_PROGRAM:
+          generate_program (&generator, frame);
+          break;
+        }
+    }
+
+  /* Helpers nothing calls would be left behind at '-O0'. */
+  for (size_t i = 0; generator.fp_linked && i < 2; ++i)
+    for (size_t j = 0; j < 4; ++j)
+      if (LLVMGetFirstUse (generator.fp_helpers[i][j]) == NULL)
+        LLVMDeleteFunction (generator.fp_helpers[i][j]);
+
+  ast_walk_destroy (&generator.walk);
+  free (generator.arguments);
+  free (generator.variables);
+  free (generator.functions);
+  free (generator.writes);
+  free (generator.joins);
+  free (generator.marks);
+  free (generator.seen);
+  ast_walk_destroy (&generator.scan);
+
+  return generator.value;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* One thread's type checking state. Variable slots are unique to their
+   declaration, so checkers on several threads can share 'variables'.
+   'functions' is only written while prototypes are collected, by one
+   checker, and is read-only afterwards. */
+struct type_checker
+{
+  struct ast *ast;
+  struct type **variables;
+  struct type **functions;
+  struct ast_walk walk;
+
+  /* Set while prototypes are collected. Otherwise prototypes are taken as
+     checked already. */
+  int prototypes;
+
+  /* Errors are fatal. A quiet checker does not print them, but jumps to
+     'fail' so the caller can tell which statement failed first. */
+  int quiet;
+  jmp_buf fail;
+};
+
+/* Called before an error is printed; only returns for a loud checker. */
+static void
+ast_type_fail (struct type_checker *checker)
+{
+  if (checker->quiet)
+    longjmp (checker->fail, 1);
+}
+
+void
+ast_type_match (struct type_checker *checker, enum type_kind a,
+                enum type_kind b, struct location location)
+{
+  if (a != b)
+    {
+      ast_type_fail (checker);
+      location_debug_print (location);
+      printf (": fatal-error: expected %s, got %s\n",
+              type_kind_string (b), type_kind_string (a));
+      abort ();
+    }
+}
+
+/*
+struct comptime_function
+{
+  const char *name;
+  struct type *type;
+};
+
+struct comptime_function functions[256];
+size_t functions_n = 0;
+
+struct comptime_variable
+{
+  const char *name;
+  struct type *type;
+};
+
+struct comptime_variable variables[256];
+size_t variables_n = 0;
+*/
+
+static uint32_t
+ast_resolve_find (struct scope *scope, const char *name)
+{
+  struct symbol *symbol = scope_find (scope, name);
+
+  return symbol ? symbol->index : AST_UNBOUND;
+}
+
+/* Bind every identifier, declaration and function argument to a variable
+   slot, and every prototype, call and user-defined operator to a function
+   index, visiting the tree in the order it is type checked. Each
+   declaration gets a slot of its own. Names that do not resolve are left
+   AST_UNBOUND, for the type checker to report where it meets them. */
+void
+ast_resolve (struct ast *ast, uint32_t root)
+{
+  struct scope *functions = scope_create ();
+  struct scope *variables = scope_create ();
+  struct ast_walk walk = { 0 };
+
+  ast->variables_n = 0;
+  ast->functions_n = 0;
+
+  ast_walk_push (&walk, root);
+
+  while (walk.size > 0)
+    {
+      struct ast_frame *frame = ast_walk_top (&walk);
+      uint32_t node = frame->node;
+      uint32_t state = frame->state++;
+      uint32_t n = ast->children_n[node];
+
+      /* The name of a call, operator, declaration or prototype is their
+         first child, which is not a use of a variable. */
+      uint32_t first = 0;
+
+      switch (ast->type[node])
+        {
+        case AST_IDENTIFIER:
+          ast->binding[node] = ast_resolve_find (variables,
+                                                 ast->value[node].s);
+          break;
+        case AST_BINARY:
+        case AST_CALL:
+          if (state == 0 && (ast->type[node] == AST_CALL
+                             || ast->state[node] == AST_OPERATOR_USER))
+            ast->binding[node] = ast_resolve_find (
+                functions, ast->value[ast_child (ast, node, 0)].s);
+          first = 1;
+          break;
+        case AST_COMPOUND:
+          if (state == 0)
+            scope_enter (variables);
+          if (state == n)
+            scope_leave (variables);
+          break;
+        case AST_DECLARATION:
+          first = 1;
+          if (state + first == n)
+            {
+              uint32_t slot = ast->variables_n++;
+
+              scope_add (variables, SYMBOL_VARIABLE,
+                         ast->value[ast_child (ast, node, 0)].s)->index
+                  = slot;
+              ast->binding[node] = slot;
+            }
+          break;
+        case AST_PROTOTYPE:
+          {
+            const char *name = ast->value[ast_child (ast, node, 0)].s;
+            uint32_t index = ast_resolve_find (functions, name);
+
+            if (index == AST_UNBOUND)
+              {
+                index = ast->functions_n++;
+                scope_add (functions, SYMBOL_FUNCTION, name)->index = index;
+              }
+
+            ast->binding[node] = index;
+            first = n;
+          }
+          break;
+        case AST_FUNCTION:
+          /* Arguments are bound after the prototype, before the body. */
+          if (state == 1)
+            {
+              uint32_t prototype = ast_child (ast, node, 0);
+
+              for (uint32_t i = 1; i < ast->children_n[prototype]; ++i)
+                {
+                  uint32_t current = ast_child (ast, prototype, i);
+                  uint32_t slot = ast->variables_n++;
+
+                  scope_add (variables, SYMBOL_VARIABLE,
+                             ast->value[current].s)->index = slot;
+                  ast->binding[current] = slot;
+                }
+            }
+          break;
+        case AST_PROGRAM:
+          if (state < n)
+            scope_clear (variables);
+          break;
+        default:
+          break;
+        }
+
+      if (first + state < n)
+        ast_walk_push (&walk, ast_child (ast, node, first + state));
+      else
+        ast_walk_pop (&walk);
+    }
+
+  ast_walk_destroy (&walk);
+  scope_destroy (functions);
+  scope_destroy (variables);
+}
+
+struct type *
+ast_type_check_binary (struct type_checker *checker, uint32_t node,
+                       struct type *left, struct type *right)
+{
+  struct ast *ast = checker->ast;
+  struct location l = ast->location[node];
+  switch (ast->state[node])
+    {
+    case AST_OPERATOR_ASSIGN:
+      ast_type_match (checker, right->kind, left->kind, l);
+      ast->expr_type[node] = left;
+      return left;
+    case AST_OPERATOR_ADD:
+    case AST_OPERATOR_SUB:
+    case AST_OPERATOR_MUL:
+    case AST_OPERATOR_DIV:
+      ast_type_match (checker, left->kind, TYPE_F64, l);
+      ast_type_match (checker, right->kind, TYPE_F64, l);
+      ast->expr_type[node] = left;
+      return left;
+    case AST_OPERATOR_LT:
+    case AST_OPERATOR_GT:
+    case AST_OPERATOR_LE:
+    case AST_OPERATOR_GE:
+      {
+        ast_type_match (checker, left->kind, TYPE_F64, l);
+        ast_type_match (checker, right->kind, TYPE_F64, l);
+        struct type *type = type_create (TYPE_BOOL);
+        ast->expr_type[node] = type;
+        return type;
+      }
+    default:
+      break;
+    }
+
+  if (ast->binding[node] != AST_UNBOUND)
+    {
+      struct type_function function
+          = checker->functions[ast->binding[node]]->value.function;
+      ast_type_match (checker, left->kind, function.argument_t[0]->kind, l);
+      ast_type_match (checker, right->kind, function.argument_t[1]->kind, l);
+      ast->expr_type[node] = function.return_t;
+      return function.return_t;
+    }
+
+  ast_type_fail (checker);
+  printf ("ERROR: undefined operator-function %s\n",
+          ast->value[ast_child (ast, node, 0)].s);
+  abort ();
+}
+
+/* Check one top-level statement, walking it with an explicit stack; 'type'
+   is what the node finished last checked to. Variables and functions are
+   looked up by their bindings, so the tree must be resolved. */
+static struct type *
+ast_type_check_node (struct type_checker *checker, uint32_t root)
+{
+  struct ast *ast = checker->ast;
+  struct ast_walk *walk = &checker->walk;
+  struct type **variables = checker->variables;
+  struct type **functions = checker->functions;
+  struct type *type = NULL;
+
+  walk->size = 0;
+  ast_walk_push (walk, root);
+
+  while (walk->size > 0)
+    {
+      struct ast_frame *frame = ast_walk_top (walk);
+      uint32_t node = frame->node;
+      uint32_t state = frame->state++;
+      uint32_t n = ast->children_n[node];
+
+      switch (ast->type[node])
+        {
+        case AST_ERROR:
+          ast_type_fail (checker);
+          printf ("%s Bad Node\n", ast_type_string (ast->type[node]));
+          abort ();
+        case AST_CAST:
+          if (state == 0)
+            {
+              ast_walk_push (walk, ast_child (ast, node, 0));
+              continue;
+            }
+
+          if (!type_can_cast (type->kind, ast->expr_type[node]->kind))
+            {
+              ast_type_fail (checker);
+              printf ("ERROR: cannot cast %s to %s\n",
+                      type_kind_string (type->kind),
+                      type_kind_string (ast->expr_type[node]->kind));
+              abort ();
+            }
+
+          type = ast->expr_type[node];
+          break;
+        case AST_IDENTIFIER:
+          {
+            if (ast->binding[node] == AST_UNBOUND)
+              {
+                ast_type_fail (checker);
+                printf ("undefined %s\n", ast->value[node].s);
+                abort();
+              }
+
+            ast->expr_type[node] = variables[ast->binding[node]];
+            type = ast->expr_type[node];
+          }
+          break;
+        case AST_NUMBER:
+          type = ast->expr_type[node];
+          break;
+        case AST_BINARY:
+          /* Left operand, then right operand. */
+          if (state < 2)
+            {
+              if (state == 1)
+                frame->data[1] = type;
+
+              ast_walk_push (walk, ast_child (ast, node, state + 1));
+              continue;
+            }
+
+          type = ast_type_check_binary (checker, node, frame->data[1],
+                                        type);
+          break;
+        case AST_CONDITIONAL:
+          if (state == 1)
+            ast_type_match (checker, type->kind, TYPE_BOOL,
+                            ast->location[ast_child (ast, node, 0)]);
+
+          if (state == 2)
+            frame->data[1] = type;
+
+          if (state < 3)
+            {
+              ast_walk_push (walk, ast_child (ast, node, state));
+              continue;
+            }
+
+          {
+            struct type *then_t = frame->data[1];
+
+            ast_type_match (checker, type->kind, then_t->kind,
+                            ast->location[ast_child (ast, node, 2)]);
+
+            ast->expr_type[node] = then_t;
+            type = then_t;
+          }
+          break;
+        case AST_COMPOUND:
+          if (state < n)
+            {
+              ast_walk_push (walk, ast_child (ast, node, state));
+              continue;
+            }
+
+          if (n == 0)
+            type = NULL;
+
+          ast->expr_type[node] = type;
+
+          if (ast->state[node] == 1)
+            type = type_create (TYPE_VOID);
+          break;
+        case AST_WHILE:
+          if (state == 0)
+            {
+              ast_walk_push (walk, ast_child (ast, node, 0));
+              continue;
+            }
+
+          if (state == 1)
+            {
+              ast_type_match (checker, type->kind, TYPE_BOOL,
+                              ast->location[ast_child (ast, node, 0)]);
+              frame->data[1] = type;
+
+              ast_walk_push (walk, ast_child (ast, node, 1));
+              continue;
+            }
+
+          type = frame->data[1];
+          break;
+        case AST_DECLARATION:
+          {
+            if (n > 1 && state == 0)
+              {
+                ast_walk_push (walk, ast_child (ast, node, 1));
+                continue;
+              }
+
+            if (n > 1)
+              ast_type_match (checker, type->kind, ast->expr_type[node]->kind,
+                              ast->location[node]);
+
+            variables[ast->binding[node]] = ast->expr_type[node];
+
+            type = ast->expr_type[node];
+          }
+          break;
+        case AST_CALL:
+          {
+            /* The function's type, then one state per argument. */
+            if (state == 0)
+              {
+                if (ast->binding[node] == AST_UNBOUND)
+                  {
+                    ast_type_fail (checker);
+                    printf ("ERROR: call to undefined function\n");
+                    abort ();
+                  }
+
+                frame->data[1] = functions[ast->binding[node]];
+              }
+
+            struct type *function_t = frame->data[1];
+            struct type_function function = function_t->value.function;
+
+            if (state > 0)
+              ast_type_match (checker, type->kind,
+                              function.argument_t[state - 1]->kind,
+                              ast->location[ast_child (ast, node, state)]);
+
+            if (state + 1 < n)
+              {
+                if (state >= function.argument_n)
+                  {
+                    ast_type_fail (checker);
+                    printf ("ERROR: argument mismatch >\n");
+                    abort ();
+                  }
+
+                ast_walk_push (walk, ast_child (ast, node, state + 1));
+                continue;
+              }
+
+            if (state < function.argument_n)
+              {
+                ast_type_fail (checker);
+                printf ("ERROR: argument mismatch <\n");
+                abort ();
+              }
+
+            ast->expr_type[node] = function.return_t;
+            type = function.return_t;
+          }
+          break;
+        case AST_PROTOTYPE:
+          {
+            struct type *ast_t = ast->expr_type[node];
+            struct type_function function = ast_t->value.function;
+
+            type = ast_t;
+
+            if (!checker->prototypes)
+              break;
+
+            ast_type_match (checker, ast_t->kind, TYPE_FUNCTION,
+                            ast->location[node]);
+
+            size_t params = function.argument_n;
+
+            if (params != n - 1)
+              {
+                ast_type_fail (checker);
+                printf ("type-argument amount mismatch\n");
+                abort ();
+              }
+
+            struct type *old_t = functions[ast->binding[node]];
+
+            if (old_t)
+              {
+                if (!type_match (ast_t, old_t))
+                  {
+                    ast_type_fail (checker);
+                    printf ("ERROR: Declared and defined function's types don't match\n");
+                    printf ("NOTE: '");
+                    type_debug_print (ast_t);
+                    printf ("' and '");
+                    type_debug_print (old_t);
+                    printf ("'\n");
+
+                    abort();
+                  }
+              }
+            else
+              functions[ast->binding[node]] = ast_t;
+          }
+          break;
+        case AST_FUNCTION:
+          if (state == 0)
+            {
+              ast_walk_push (walk, ast_child (ast, node, 0));
+              continue;
+            }
+
+          if (state == 1)
+            {
+              struct type *result = type;
+              uint32_t prototype = ast_child (ast, node, 0);
+
+              frame->data[1] = result;
+
+              for (uint32_t i = 1; i < ast->children_n[prototype]; ++i)
+                {
+                  uint32_t current = ast_child (ast, prototype, i);
+
+                  // struct comptime_variable v;
+                  // v.name = current->value.token.value.s;
+                  // v.type = result->value.function.argument_t[n];
+                  // // printf ("variable, %s, ", v.name);
+                  // // type_debug_print (v.type);
+                  // // printf ("\n");
+                  // variables[variables_n++] = v;
+
+                  variables[ast->binding[current]]
+                      = result->value.function.argument_t[i - 1];
+                }
+
+              ast_walk_push (walk, ast_child (ast, node, 1));
+              continue;
+            }
+
+          {
+            struct type *result = frame->data[1];
+
+            ast_type_match (checker, type->kind,
+                            result->value.function.return_t->kind,
+                            ast->location[ast_child (ast, node, 1)]);
+
+            type = result;
+          }
+          break;
+        default:
+          ast_type_fail (checker);
+          printf ("%s Bad Node\n", ast_type_string (ast->type[node]));
+          abort ();
+        }
+
+      ast_walk_pop (walk);
+    }
+
+  return type;
+}
+
+/* Returns nonzero if checking 'node' quietly failed. */
+static int
+ast_type_check_try (struct type_checker *checker, uint32_t node)
+{
+  if (setjmp (checker->fail))
+    return 1;
+
+  ast_type_check_node (checker, node);
+
+  return 0;
+}
+
+/* Function bodies are not checked on a thread of their own below this many
+   statements per thread. */
+#define AST_TYPE_CHECK_CHUNK_MIN 256
+
+struct ast_type_check_chunk
+{
+  struct type_checker checker;
+  uint32_t root;
+  size_t first;
+  size_t n;
+  /* The first statement that failed, or SIZE_MAX. */
+  size_t failed;
+  pthread_t thread;
+};
+
+static void *
+ast_type_check_chunk_run (void *data)
+{
+  struct ast_type_check_chunk *chunk = data;
+  struct ast *ast = chunk->checker.ast;
+
+  for (size_t i = chunk->first; i < chunk->first + chunk->n; ++i)
+    if (ast_type_check_try (&chunk->checker,
+                            ast_child (ast, chunk->root, i)))
+      {
+        chunk->failed = i;
+        break;
+      }
+
+  return NULL;
+}
+
+/* Check the program 'root' in two phases. Prototypes are collected in
+   source order first, into the table of function types. Function bodies
+   only read that table, so they are then checked on up to 'threads'
+   threads. Checkers stay quiet until the first failing statement in
+   source order is known, and that statement is checked again to print its
+   error, so what is reported does not depend on the threads. */
+void
+ast_type_check (struct ast *ast, uint32_t root, size_t threads)
+{
+  size_t statements = ast->children_n[root];
+
+  struct type_checker checker = { 0 };
+
+  checker.ast = ast;
+  checker.variables = calloc (ast->variables_n + 1, sizeof (struct type *));
+  checker.functions = calloc (ast->functions_n + 1, sizeof (struct type *));
+  checker.prototypes = 1;
+  checker.quiet = 1;
+
+  /* Statements up to 'limit' have valid prototypes. */
+  size_t limit = 0;
+
+  for (; limit < statements; ++limit)
+    {
+      uint32_t node = ast_child (ast, root, limit);
+
+      if (ast_match (ast, node, AST_FUNCTION))
+        node = ast_child (ast, node, 0);
+
+      if (ast_type_check_try (&checker, node))
+        break;
+    }
+
+  checker.prototypes = 0;
+
+  if (threads > limit / AST_TYPE_CHECK_CHUNK_MIN)
+    threads = limit / AST_TYPE_CHECK_CHUNK_MIN;
+  if (threads < 1)
+    threads = 1;
+
+  struct ast_type_check_chunk *chunks;
+
+  chunks = calloc (threads, sizeof (struct ast_type_check_chunk));
+
+  for (size_t i = 0; i < threads; ++i)
+    {
+      struct ast_type_check_chunk *chunk = &chunks[i];
+
+      chunk->checker = checker;
+      chunk->checker.walk = (struct ast_walk){ 0 };
+      chunk->root = root;
+      chunk->first = limit * i / threads;
+      chunk->n = limit * (i + 1) / threads - chunk->first;
+      chunk->failed = SIZE_MAX;
+    }
+
+  for (size_t i = 1; i < threads; ++i)
+    pthread_create (&chunks[i].thread, NULL, ast_type_check_chunk_run,
+                    &chunks[i]);
+
+  ast_type_check_chunk_run (&chunks[0]);
+
+  for (size_t i = 1; i < threads; ++i)
+    pthread_join (chunks[i].thread, NULL);
+
+  size_t failed = limit;
+
+  for (size_t i = 0; i < threads; ++i)
+    {
+      if (chunks[i].failed < failed)
+        failed = chunks[i].failed;
+
+      ast_walk_destroy (&chunks[i].checker.walk);
+    }
+
+  free (chunks);
+
+  if (failed < statements)
+    {
+      uint32_t node = ast_child (ast, root, failed);
+
+      /* Either a body failed, or the prototype 'limit' did. */
+      if (failed == limit && ast_match (ast, node, AST_FUNCTION))
+        node = ast_child (ast, node, 0);
+
+      checker.prototypes = failed == limit;
+      checker.quiet = 0;
+      ast_type_check_node (&checker, node);
 
-  scope_destroy (child);
+      abort ();
+    }
 
-  return result;
+  ast_walk_destroy (&checker.walk);
+  free (checker.variables);
+  free (checker.functions);
 }
 
-LLVMValueRef
-generate_while (struct ast *node, struct scope *scope)
+/* Calls between function indices as arrays of successors: those of 'f'
+   are 'to[first[f] .. first[f + 1])'. */
+struct ast_calls
 {
-  LLVMBasicBlockRef current_bb = LLVMGetInsertBlock (builder);
-  LLVMValueRef fn = LLVMGetBasicBlockParent (current_bb);
-
-  LLVMBasicBlockRef condBlock = LLVMAppendBasicBlock (fn, "while.cond");
-  LLVMBasicBlockRef bodyBlock = LLVMAppendBasicBlock (fn, "while.body");
-  LLVMBasicBlockRef endBlock  = LLVMAppendBasicBlock (fn, "while.end");
-
-  LLVMBuildBr (builder, condBlock);
+  uint32_t *first;
+  uint32_t *to;
+};
 
-  LLVMPositionBuilderAtEnd (builder, condBlock);
-  LLVMValueRef condVal = generate (node->child, scope);
-  if (!condVal)
-    return NULL;
+static struct ast_calls
+ast_calls_create (uint32_t n, const uint32_t *from, const uint32_t *to,
+                  size_t edges)
+{
+  struct ast_calls calls;
 
-  LLVMBuildCondBr (builder, condVal, bodyBlock, endBlock);
+  calls.first = calloc (n + 2, sizeof (uint32_t));
+  calls.to = malloc ((edges + 1) * sizeof (uint32_t));
 
-  LLVMPositionBuilderAtEnd (builder, bodyBlock);
-  LLVMValueRef bodyVal = generate (node->child->next, scope);
-  if (!bodyVal)
-    return NULL;
+  for (size_t i = 0; i < edges; ++i)
+    calls.first[from[i] + 2]++;
 
-  LLVMBuildBr(builder, condBlock);
-  bodyBlock = LLVMGetInsertBlock(builder);
+  for (uint32_t f = 0; f < n; ++f)
+    calls.first[f + 2] += calls.first[f + 1];
 
-  LLVMPositionBuilderAtEnd (builder, endBlock);
+  for (size_t i = 0; i < edges; ++i)
+    calls.to[calls.first[from[i] + 1]++] = to[i];
 
-  return LLVMConstNull(LLVMDoubleType());
+  return calls;
 }
 
-LLVMValueRef
-generate_declaration (struct ast *node, struct scope *scope)
+static void
+ast_calls_destroy (struct ast_calls *calls)
 {
-  const char *name = node->child->value.token.value.s;
+  free (calls->first);
+  free (calls->to);
+}
 
-  LLVMBasicBlockRef block = LLVMGetInsertBlock (builder);
-  LLVMValueRef function = LLVMGetBasicBlockParent (block);
+/* Clear 'effect' from every caller of a function that lacks it, following
+   'callers' from the functions that lack it to begin with. */
+static void
+ast_effects_spread (uint8_t *effects, uint32_t n,
+                    const struct ast_calls *callers, uint8_t effect)
+{
+  uint32_t *work = malloc ((n + 1) * sizeof (uint32_t));
+  size_t work_n = 0;
 
-  LLVMTypeRef type = type_kind_to_llvm (node->expr_type->kind);
-  LLVMValueRef alloca = create_entry_alloca (function, name, type);
+  for (uint32_t f = 0; f < n; ++f)
+    if (!(effects[f] & effect))
+      work[work_n++] = f;
 
-  if (node->child->next != NULL)
+  while (work_n > 0)
     {
-      LLVMValueRef value = generate (node->child->next, scope);
-      LLVMBuildStore (builder, value, alloca);
-    }
+      uint32_t f = work[--work_n];
 
-  struct symbol *symbol;
-
-  symbol = symbol_create (SYMBOL_VALUE, name);
-  symbol->value.value = alloca;
+      for (uint32_t i = callers->first[f]; i < callers->first[f + 1]; ++i)
+        {
+          uint32_t caller = callers->to[i];
 
-  scope_add (scope, symbol);
+          if (effects[caller] & effect)
+            {
+              effects[caller] &= ~effect;
+              work[work_n++] = caller;
+            }
+        }
+    }
 
-  return alloca;
+  free (work);
 }
 
-LLVMValueRef
-generate_call (struct ast *node, struct scope *scope)
+/* Clear AST_EFFECT_NORECURSE from every function on a cycle of 'calls':
+   those in a strongly connected component of more than one function, and
+   those calling themselves. Tarjan's algorithm, with 'walk' as its stack
+   of functions being visited. */
+static void
+ast_effects_cycles (uint8_t *effects, uint32_t n,
+                    const struct ast_calls *calls)
 {
-  const char *name = node->child->value.token.value.s;
-  LLVMValueRef function = LLVMGetNamedFunction (module, name);
-  if (!function)
+  uint32_t *order = malloc ((n + 1) * sizeof (uint32_t));
+  uint32_t *low = malloc ((n + 1) * sizeof (uint32_t));
+  uint32_t *component = malloc ((n + 1) * sizeof (uint32_t));
+  uint8_t *open = calloc (n + 1, 1);
+  size_t component_n = 0;
+  uint32_t visited = 0;
+  struct ast_walk walk = { 0 };
+
+  for (uint32_t f = 0; f < n; ++f)
+    order[f] = UINT32_MAX;
+
+  for (uint32_t root = 0; root < n; ++root)
     {
-      return generate_error (node->location, "undefined-function");
-      // printf ("undefined function '%s'\n", name);
-      // return NULL;
-    }
+      if (order[root] != UINT32_MAX)
+        continue;
 
-  LLVMTypeRef type = LLVMGetElementType(LLVMTypeOf(function));
-  int variadic = LLVMIsFunctionVarArg (type);
-
-  struct ast *current;
-  size_t n = 0;
+      ast_walk_push (&walk, root);
 
-  current = node->child;
-  while (current->next)
-    current = current->next, ++n;
+      while (walk.size > 0)
+        {
+          struct ast_frame *frame = ast_walk_top (&walk);
+          uint32_t f = frame->node;
 
-  size_t params = LLVMCountParams (function);
-  if ((!variadic && n != params) || (variadic && n < params))
-    return generate_error (node->location, "argument # mismatch");
-    // {
-    //   fprintf (stderr, "\n");
-    //   return NULL;
-    // }
+          if (frame->state == 0)
+            {
+              order[f] = low[f] = visited++;
+              component[component_n++] = f;
+              open[f] = 1;
+            }
 
-  LLVMValueRef arguments[n];
+          uint32_t i = calls->first[f] + frame->state;
 
-  current = node->child->next;
-  for (size_t i = 0; i < n; ++i)
-    {
-      arguments[i] = generate (current, scope);
-      if (!arguments[i])
-        return NULL;
+          if (i < calls->first[f + 1])
+            {
+              uint32_t callee = calls->to[i];
 
-      current = current->next;
-    }
+              frame->state++;
 
-  LLVMValueRef call = LLVMBuildCall2 (builder, type, function, arguments, n,
-                                      "");
-  return call;
-}
+              if (callee == f)
+                effects[f] &= ~AST_EFFECT_NORECURSE;
 
-LLVMValueRef
-generate_prototype (struct ast *node, struct scope *scope)
-{
-  const char *name = node->child->value.token.value.s;
+              if (order[callee] == UINT32_MAX)
+                ast_walk_push (&walk, callee);
+              else if (open[callee] && order[callee] < low[f])
+                low[f] = order[callee];
 
-  struct ast *current;
-  size_t n = 0;
+              continue;
+            }
 
-  current = node->child;
-  while (current->next)
-    current = current->next, ++n;
+          ast_walk_pop (&walk);
 
-  struct type_function t_func = node->expr_type->value.function;
+          if (walk.size > 0)
+            {
+              uint32_t caller = ast_walk_top (&walk)->node;
 
-  LLVMTypeRef arguments[n];
-  for (size_t i = 0; i < n; ++i)
-    {
-      arguments[i] = type_kind_to_llvm (t_func.argument_t[i]->kind);
-      // arguments[i] = // LLVMDoubleTypeInContext (context);
-    }
+              if (low[f] < low[caller])
+                low[caller] = low[f];
+            }
 
-  LLVMTypeRef type = LLVMFunctionType (type_kind_to_llvm (t_func.return_t->kind),
-                                       arguments, n, node->state);
+          if (low[f] != order[f])
+            continue;
 
-  LLVMValueRef function = LLVMAddFunction(module, name, type);
+          int cycle = component[component_n - 1] != f;
 
-  LLVMValueRef argument = LLVMGetFirstParam (function);
-  current = node->child->next;
+          uint32_t member;
+          do
+            {
+              member = component[--component_n];
+              open[member] = 0;
 
-  while (argument != NULL && current != NULL)
-    {
-      LLVMSetValueName (argument, current->value.token.value.s);
-      current = current->next;
-      argument = LLVMGetNextParam (argument);
+              if (cycle)
+                effects[member] &= ~AST_EFFECT_NORECURSE;
+            }
+          while (member != f);
+        }
     }
 
-  return function;
+  ast_walk_destroy (&walk);
+  free (order);
+  free (low);
+  free (component);
+  free (open);
 }
 
-LLVMValueRef
-generate_function (struct ast *node, struct scope *scope)
+/* Prove what every function index does, from the calls and loops in the
+   bodies of the program's functions; see 'enum ast_effect'. A function
+   without a body, like 'putd', may do anything, and so may everything
+   that calls it. Unless 'flush' flushes denormals everywhere, so does a
+   'flush_denormals' function, which writes MXCSR; see
+   'target_flush_function'. */
+uint8_t *
+ast_effects (const struct ast *ast, uint32_t root, int flush)
 {
-  const char *name = node->child->child->value.token.value.s;
-  LLVMValueRef function = LLVMGetNamedFunction (module, name);
+  uint32_t n = ast->functions_n;
+  uint8_t *effects = calloc (n + 1, 1);
+  uint8_t *defined = calloc (n + 1, 1);
 
-  if (!function)
-    function = generate_prototype (node->child, scope);
+  uint32_t *from = NULL;
+  uint32_t *to = NULL;
+  size_t edges = 0;
+  size_t capacity = 0;
 
-  if (!function)
-    return NULL;
+  struct ast_walk walk = { 0 };
 
-  LLVMBasicBlockRef bb = LLVMAppendBasicBlockInContext (context, function,
-                                                        "entry");
-  LLVMPositionBuilderAtEnd (builder, bb);
+  for (uint32_t i = 0; i < ast->children_n[root]; ++i)
+    {
+      uint32_t function = ast_child (ast, root, i);
 
-  size_t n = 0;
+      if (!ast_match (ast, function, AST_FUNCTION))
+        continue;
 
-  scope_clear (scope);
-  for (LLVMValueRef argument = LLVMGetFirstParam (function); argument != NULL;
-       argument = LLVMGetNextParam (argument), ++n)
-    {
-      const char *name = LLVMGetValueName (argument);
-      LLVMTypeRef type = type_kind_to_llvm (node->child->expr_type->value.function.argument_t[n]->kind);
-      LLVMValueRef alloca = create_entry_alloca (function, name, type);
+      uint32_t f = ast->binding[ast_child (ast, function, 0)];
 
-      LLVMBuildStore (builder, argument, alloca);
+      if (f == AST_UNBOUND)
+        continue;
 
-      struct symbol *symbol;
+      uint8_t effect = AST_EFFECT_PURE | AST_EFFECT_NORECURSE
+                       | AST_EFFECT_WILLRETURN;
 
-      symbol = symbol_create (SYMBOL_VALUE, name);
-      symbol->value.value = alloca;
+      if (!flush
+          && ast->state[ast_child (ast, function, 0)]
+                 & AST_PROTOTYPE_FLUSH_DENORMALS)
+        effect = 0;
 
-      scope_add (scope, symbol);
-    }
+      ast_walk_push (&walk, ast_child (ast, function, 1));
 
-  LLVMValueRef returnV = generate (node->child->next, scope);
+      while (walk.size > 0)
+        {
+          struct ast_frame *frame = ast_walk_top (&walk);
+          uint32_t node = frame->node;
+
+          if (frame->state == 0)
+            {
+              if (ast_match (ast, node, AST_WHILE))
+                effect &= ~AST_EFFECT_WILLRETURN;
+
+              if (ast_match (ast, node, AST_CALL)
+                  || (ast_match (ast, node, AST_BINARY)
+                      && ast->state[node] == AST_OPERATOR_USER))
+                {
+                  if (ast->binding[node] == AST_UNBOUND)
+                    effect = 0;
+                  else
+                    {
+                      if (edges >= capacity)
+                        {
+                          capacity = capacity ? capacity * 2 : 256;
+                          from = realloc (from, capacity * sizeof (uint32_t));
+                          to = realloc (to, capacity * sizeof (uint32_t));
+                        }
+
+                      from[edges] = f;
+                      to[edges] = ast->binding[node];
+                      edges++;
+                    }
+                }
+            }
+
+          if (frame->state < ast->children_n[node])
+            ast_walk_push (&walk, ast_child (ast, node, frame->state++));
+          else
+            ast_walk_pop (&walk);
+        }
 
-  if (node->child->expr_type->value.function.return_t->kind != TYPE_VOID)
-    LLVMBuildRet (builder, returnV);
-  else
-    LLVMBuildRetVoid (builder);
+      /* Every body of a name ends up in the same function. */
+      effects[f] = defined[f] ? effects[f] & effect : effect;
+      defined[f] = 1;
+    }
 
-  LLVMRunFunctionPassManager(pass_manager, function);
+  ast_walk_destroy (&walk);
+  free (defined);
 
-  return function;
-}
+  struct ast_calls calls = ast_calls_create (n, from, to, edges);
+  struct ast_calls callers = ast_calls_create (n, to, from, edges);
 
-LLVMValueRef
-generate_program (struct ast *node, struct scope *scope)
-{
-  struct ast *current = node->child;
+  ast_effects_cycles (effects, n, &calls);
 
-  while (current != NULL)
+  /* Whatever is not pure may recurse through a callback, and whatever may
+     recurse may not return. */
+  for (uint32_t f = 0; f < n; ++f)
     {
-      generate (current, scope);
-      current = current->next;
+      if (!(effects[f] & AST_EFFECT_PURE))
+        effects[f] = 0;
+      if (!(effects[f] & AST_EFFECT_NORECURSE))
+        effects[f] &= ~AST_EFFECT_WILLRETURN;
     }
 
-  return NULL;
-}
+  ast_effects_spread (effects, n, &callers, AST_EFFECT_PURE);
+  ast_effects_spread (effects, n, &callers, AST_EFFECT_WILLRETURN);
 
-LLVMValueRef
-generate (struct ast *node, struct scope *scope)
-{
-  switch (node->type)
-    {
-    case AST_ERROR:
-      return NULL;
-    case AST_CAST:
-      return generate_cast (node, scope);
-    case AST_IDENTIFIER:
-      return generate_identifier (node, scope);
-    case AST_NUMBER:
-      return generate_number (node, scope);
-    case AST_BINARY:
-      return generate_binary (node, scope);
-    case AST_CONDITIONAL:
-      return generate_conditional (node, scope);
-    case AST_COMPOUND:
-      return generate_compound (node, scope);
-    case AST_WHILE:
-      return generate_while (node, scope);
-    case AST_DECLARATION:
-      return generate_declaration (node, scope);
-    case AST_CALL:
-      return generate_call (node, scope);
-    case AST_PROTOTYPE:
-      return generate_prototype (node, scope);
-    case AST_FUNCTION:
-      return generate_function (node, scope);
-    case AST_PROGRAM:
-      return generate_program (node, scope);
-    }
-}
+  for (uint32_t f = 0; f < n; ++f)
+    if (!(effects[f] & AST_EFFECT_PURE))
+      effects[f] = 0;
+
+  ast_calls_destroy (&calls);
+  ast_calls_destroy (&callers);
+  free (from);
+  free (to);
 
+  return effects;
+}
 
 /* -------------------------------------------------------------------------- */
 
-void
-ast_type_match (enum type_kind a, enum type_kind b, struct location location)
+/* An optimization level, '-O0' .. '-O3' or '-Os'. */
+enum options_level
 {
-  if (a != b)
-    {
-      location_debug_print (location);
-      printf (": fatal-error: expected %s, got %s\n",
-              type_kind_string (b), type_kind_string (a));
-      abort ();
-    }
-}
+  OPTIONS_LEVEL_0,
+  OPTIONS_LEVEL_1,
+  OPTIONS_LEVEL_2,
+  OPTIONS_LEVEL_3,
+  OPTIONS_LEVEL_S,
+};
 
-/*
-struct comptime_function
-{
-  const char *name;
-  struct type *type;
+/* The new pass manager pipeline and the code generation level of each
+   optimization level. */
+static const char *const OPTIONS_LEVEL_PIPELINE[] = {
+  "default<O0>", "default<O1>", "default<O2>", "default<O3>", "default<Os>",
 };
 
-struct comptime_function functions[256];
-size_t functions_n = 0;
+static const LLVMCodeGenOptLevel OPTIONS_LEVEL_CODEGEN[] = {
+  LLVMCodeGenLevelNone,
+  LLVMCodeGenLevelLess,
+  LLVMCodeGenLevelDefault,
+  LLVMCodeGenLevelAggressive,
+  LLVMCodeGenLevelDefault,
+};
 
-struct comptime_variable
+struct options
 {
-  const char *name;
-  struct type *type;
+  const char *input;
+  size_t threads;
+  enum options_level level;
+  /* '-mcpu' (or '-march') and '-mattr', NULL when not given. A CPU of
+     "native" is the host. */
+  const char *cpu;
+  const char *features;
+  /* '-ffast-math' and '-ffp-contract=fast|off'. */
+  enum generate_fp fp;
+  /* '-fdenormal-fp-math=preserve-sign', rather than 'ieee'. */
+  int flush;
 };
 
-struct comptime_variable variables[256];
-size_t variables_n = 0;
-*/
-
-struct type *
-ast_type_check (struct ast *ast, struct arena *arena, struct scope *fs,
-                struct scope *vs)
+/* The value of option 'name' at 'argv[*i]', either attached ("-j4") or as
+   the next argument ("-j 4"). */
+static const char *
+options_value (int argc, char *argv[], int *i, const char *name)
 {
-  switch (ast->type)
-    {
-    case AST_ERROR:
-      break;
-    case AST_CAST:
-      {
-        struct type *type = ast_type_check (ast->child, arena, fs, vs);
-
-        if (!type_can_cast (type->kind, ast->expr_type->kind))
-          {
-            printf ("ERROR: cannot cast %s to %s\n",
-                    type_kind_string (type->kind),
-                    type_kind_string (ast->expr_type->kind));
-            abort ();
-          }
-        return ast->expr_type;
-      }
-      break;
-    case AST_IDENTIFIER:
-      {
-        struct symbol *symbol = scope_find (vs, ast->value.token.value.s);
-        if (symbol)
-          {
-            ast->expr_type = symbol->value.type;
-            return ast->expr_type;
-          }
-
-        printf ("undefined %s\n", ast->value.token.value.s);
-        abort();
-      }
-      break;
-    case AST_NUMBER:
-      return ast->expr_type;
-    case AST_BINARY:
-      {
-        struct type *left = ast_type_check (ast->child->next, arena, fs, vs);
-        struct type *right = ast_type_check (ast->child->next->next, arena, fs, vs);
-        struct location l = ast->location;
-        const char *operator = ast->child->value.token.value.s;
-
-        if (strcmp (operator, "=") == 0)
-          {
-            ast_type_match (right->kind, left->kind, l);
-            ast->expr_type = left;
-            return left;
-          }
-
-        if (strcmp (operator, "+") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            ast->expr_type = left;
-            return left;
-          }
-
-        if (strcmp (operator, "-") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            ast->expr_type = left;
-            return left;
-          }
-
-        if (strcmp (operator, "*") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            ast->expr_type = left;
-            return left;
-          }
-
-        if (strcmp (operator, "/") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            ast->expr_type = left;
-            return left;
-          }
-
-        if (strcmp (operator, "<") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            struct type *type = type_create (TYPE_BOOL, arena);
-            ast->expr_type = type;
-            return type;
-          }
-
-        if (strcmp (operator, ">") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            struct type *type = type_create (TYPE_BOOL, arena);
-            ast->expr_type = type;
-            return type;
-          }
+  size_t length = strlen (name);
 
-        if (strcmp (operator, "<=") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            struct type *type = type_create (TYPE_BOOL, arena);
-            ast->expr_type = type;
-            return type;
-          }
+  if (strncmp (argv[*i], name, length) != 0)
+    return NULL;
 
-        if (strcmp (operator, ">=") == 0)
-          {
-            ast_type_match (left->kind, TYPE_F64, l);
-            ast_type_match (right->kind, TYPE_F64, l);
-            struct type *type = type_create (TYPE_BOOL, arena);
-            ast->expr_type = type;
-            return type;
-          }
+  if (argv[*i][length] != '\0')
+    return argv[*i] + length;
 
-        struct symbol *symbol = scope_find (fs, operator);
+  if (*i + 1 < argc)
+    return argv[++*i];
 
-        if (symbol)
-          {
-            struct type_function function = symbol->value.type->value.function;
-            ast_type_match (left->kind, function.argument_t[0]->kind, l);
-            ast_type_match (right->kind, function.argument_t[1]->kind, l);
-            ast->expr_type = function.return_t;
-            return function.return_t;
-          }
+  return NULL;
+}
 
-        printf ("ERROR: undefined operator-function %s\n", operator);
-        abort ();
-        /* */
+/* The level of '-O<level>' in 'arg'; '-O' alone is '-O1'. */
+static int
+options_level (const char *arg, enum options_level *level)
+{
+  if (strncmp (arg, "-O", 2) != 0)
+    return 0;
+
+  if (strcmp (arg + 2, "") == 0 || strcmp (arg + 2, "1") == 0)
+    *level = OPTIONS_LEVEL_1;
+  else if (strcmp (arg + 2, "0") == 0)
+    *level = OPTIONS_LEVEL_0;
+  else if (strcmp (arg + 2, "2") == 0)
+    *level = OPTIONS_LEVEL_2;
+  else if (strcmp (arg + 2, "3") == 0)
+    *level = OPTIONS_LEVEL_3;
+  else if (strcmp (arg + 2, "s") == 0)
+    *level = OPTIONS_LEVEL_S;
+  else
+    return 0;
 
-      }
-      break;
-    case AST_CONDITIONAL:
-      {
-        struct type *cond = ast_type_check (ast->child, arena, fs, vs);
+  return 1;
+}
 
-        ast_type_match (cond->kind, TYPE_BOOL, ast->child->location);
+static int
+options_parse (struct options *options, int argc, char *argv[])
+{
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
 
-        struct type *then_t = ast_type_check (ast->child->next, arena, fs, vs);
-        struct type *else_t = ast_type_check (ast->child->next->next, arena, fs, vs);
-        ast_type_match (else_t->kind, then_t->kind, ast->child->next->next->location);
+  options->input = NULL;
+  options->threads = cpus > 0 ? cpus : 1;
+  options->level = OPTIONS_LEVEL_0;
+  options->cpu = NULL;
+  options->features = NULL;
+  options->fp = GENERATE_FP_STRICT;
+  options->flush = 0;
 
-        ast->expr_type = then_t;
-        return then_t;
-      }
-      break;
-    case AST_COMPOUND:
-      {
-        struct scope *child = scope_create (vs);
-
-        struct ast *current = ast->child;
-        struct type *type;
-        while (current != NULL)
-          type = ast_type_check (current, arena, fs, child),
-          current = current->next;
-        ast->expr_type = type;
-
-        scope_destroy (child);
-        if (ast->state == 1)
-          return type_create (TYPE_VOID, arena);
-        return type;
-      }
-      break;
-    case AST_WHILE:
-      {
-        struct type *cond = ast_type_check (ast->child, arena, fs, vs);
-        ast_type_match (cond->kind, TYPE_BOOL, ast->child->location);
-        (void)ast_type_check (ast->child->next, arena, fs, vs);
-        return cond;
-      }
-      break;
-    case AST_DECLARATION:
-      {
-        if (ast->child->next)
-          {
-            struct type *right = ast_type_check (ast->child->next, arena, fs, vs);
-            ast_type_match (right->kind, ast->expr_type->kind, ast->location);
-          }
+  for (int i = 1; i < argc; ++i)
+    {
+      const char *value;
 
-        struct symbol *symbol;
+      if ((value = options_value (argc, argv, &i, "-j")))
+        {
+          options->threads = strtoul (value, NULL, 10);
+          if (options->threads == 0)
+            options->threads = 1;
+        }
+      else if (options_level (argv[i], &options->level))
+        ;
+      else if ((value = options_value (argc, argv, &i, "-mcpu="))
+               || (value = options_value (argc, argv, &i, "-march=")))
+        options->cpu = value;
+      else if ((value = options_value (argc, argv, &i, "-mattr=")))
+        options->features = value;
+      else if (strcmp (argv[i], "-ffast-math") == 0)
+        options->fp = GENERATE_FP_FAST;
+      else if ((value = options_value (argc, argv, &i, "-ffp-contract=")))
+        {
+          if (strcmp (value, "fast") == 0)
+            options->fp = GENERATE_FP_CONTRACT;
+          else if (strcmp (value, "off") == 0)
+            options->fp = GENERATE_FP_STRICT;
+          else
+            return -1;
+        }
+      else if ((value = options_value (argc, argv, &i,
+                                       "-fdenormal-fp-math=")))
+        {
+          if (strcmp (value, "preserve-sign") == 0)
+            options->flush = 1;
+          else if (strcmp (value, "ieee") == 0)
+            options->flush = 0;
+          else
+            return -1;
+        }
+      else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        return -1;
+      else if (options->input == NULL)
+        options->input = argv[i];
+      else
+        return -1;
+    }
 
-        symbol = symbol_create (SYMBOL_TYPE, ast->child->value.token.value.s);
-        symbol->value.type = ast->expr_type;
+  char *triple = LLVMGetDefaultTargetTriple ();
+  const char *feature = NULL;
+  size_t length;
+  int known = 1;
 
-        scope_add (vs, symbol);
+  if (options->cpu != NULL && strcmp (options->cpu, "native") != 0
+      && !target_cpu_known (triple, options->cpu))
+    {
+      fprintf (stderr, "error: unknown CPU '%s' for %s\n", options->cpu,
+               triple);
+      known = 0;
+    }
 
-        return ast->expr_type;
-      }
-      break;
-    case AST_CALL:
-      {
-        struct symbol *symbol = scope_find (fs, ast->child->value.token.value.s);
+  if (options->features != NULL
+      && (feature = target_features_unknown (triple, options->features,
+                                             &length)))
+    {
+      fprintf (stderr, "error: unknown feature '%.*s' for %s\n",
+               (int)length, feature, triple);
+      known = 0;
+    }
 
-        if (symbol)
-          {
-            struct ast *current = ast->child->next;
-            size_t n = 0;
+  LLVMDisposeMessage (triple);
 
-            struct type_function function = symbol->value.type->value.function;
+  if (!known)
+    return -1;
 
-            while (current != NULL)
-              {
-                if (n >= function.argument_n)
-                  {
-                    printf ("ERROR: argument mismatch >\n");
-                    abort ();
-                  }
+  return options->input == NULL ? -1 : 0;
+}
 
-                struct type *argument = ast_type_check (current, arena, fs, vs);
+/* The CPU to compile for. "native" is the host's CPU. */
+static char *
+target_cpu (const struct options *options)
+{
+  if (options->cpu == NULL)
+    return strdup ("");
 
-                ast_type_match (argument->kind, function.argument_t[n]->kind,
-                                current->location);
+  if (strcmp (options->cpu, "native") != 0)
+    return strdup (options->cpu);
 
-                current = current->next;
-                n++;
-              }
+  char *host = LLVMGetHostCPUName ();
+  char *cpu = strdup (host);
 
-            if (n < function.argument_n)
-              {
-                printf ("ERROR: argument mismatch <\n");
-                abort ();
-              }
+  LLVMDisposeMessage (host);
 
-            ast->expr_type = function.return_t;
-            return function.return_t;
-          }
+  return cpu;
+}
 
-        printf ("ERROR: call to undefined function\n");
-        abort ();
-      }
-      break;
-    case AST_PROTOTYPE:
-      {
-        struct type *ast_t = ast->expr_type;
-        struct type_function function = ast_t->value.function;
+/* The features to compile for: the host's for a "native" CPU, followed by
+   the ones given with '-mattr', which win. */
+static char *
+target_features (const struct options *options)
+{
+  const char *extra = options->features ? options->features : "";
 
-        ast_type_match (ast_t->kind, TYPE_FUNCTION, ast->location);
+  if (options->cpu == NULL || strcmp (options->cpu, "native") != 0)
+    return strdup (extra);
 
-        struct ast *current = ast->child->next;
-        size_t n = 0;
-        while (current != NULL)
-          n++, current = current->next;
+  char *host = LLVMGetHostCPUFeatures ();
+  size_t size = strlen (host) + strlen (extra) + 2;
+  char *features = malloc (size);
 
-        size_t params = function.argument_n;
+  snprintf (features, size, "%s%s%s", host, *extra ? "," : "", extra);
 
-        if (params != n)
-          {
-            printf ("type-argument amount mismatch\n");
-            abort ();
-          }
+  LLVMDisposeMessage (host);
 
-        struct symbol *new_symbol;
+  return features;
+}
 
-        new_symbol = symbol_create (SYMBOL_TYPE, ast->child->value.token.value.s);
-        new_symbol->value.type = ast_t;
+/* Record the target on every function defined in 'module', so passes that
+   look at a function's attributes, like the vectorizers, see it. */
+static void
+target_stamp (LLVMModuleRef module, const char *cpu, const char *features)
+{
+  for (LLVMValueRef function = LLVMGetFirstFunction (module); function;
+       function = LLVMGetNextFunction (function))
+    {
+      if (LLVMIsDeclaration (function))
+        continue;
+
+      if (*cpu)
+        LLVMAddAttributeAtIndex (
+            function, LLVMAttributeFunctionIndex,
+            LLVMCreateStringAttribute (context, "target-cpu", 10, cpu,
+                                       strlen (cpu)));
+
+      if (*features)
+        LLVMAddAttributeAtIndex (
+            function, LLVMAttributeFunctionIndex,
+            LLVMCreateStringAttribute (context, "target-features", 15,
+                                       features, strlen (features)));
+    }
+}
 
-        struct symbol *old_symbol = scope_find (fs, new_symbol->name);
+/* Sets FTZ and DAZ in MXCSR before anything else runs, like crtfastmath.o
+   does for C. */
+static const char TARGET_FLUSH_SOURCE[]
+    = "define internal void @fp.flush() {\n"
+      "  %mxcsr = alloca i32\n"
+      "  %p = bitcast i32* %mxcsr to i8*\n"
+      "  call void @llvm.x86.sse.stmxcsr(i8* %p)\n"
+      "  %old = load i32, i32* %mxcsr\n"
+      "  %new = or i32 %old, 32832\n"
+      "  store i32 %new, i32* %mxcsr\n"
+      "  call void @llvm.x86.sse.ldmxcsr(i8* %p)\n"
+      "  ret void\n"
+      "}\n"
+      "declare void @llvm.x86.sse.stmxcsr(i8*)\n"
+      "declare void @llvm.x86.sse.ldmxcsr(i8*)\n"
+      "@llvm.global_ctors = appending global [1 x { i32, void ()*, i8* }] "
+      "[{ i32, void ()*, i8* } { i32 65535, void ()* @fp.flush, i8* null }]\n";
+
+/* Calls the MXCSR intrinsic 'name' on the i32 at 'pointer'. */
+static void
+target_flush_call (LLVMModuleRef module, const char *name, LLVMValueRef pointer)
+{
+  unsigned id = LLVMLookupIntrinsicID (name, strlen (name));
+  LLVMValueRef intrinsic = LLVMGetIntrinsicDeclaration (module, id, NULL, 0);
+  LLVMTypeRef type = LLVMIntrinsicGetType (context, id, NULL, 0);
+  LLVMValueRef argument = LLVMBuildBitCast (
+      builder, pointer,
+      LLVMPointerType (LLVMInt8TypeInContext (context), 0), "");
+
+  LLVMBuildCall2 (builder, type, intrinsic, &argument, 1, "");
+}
 
-        if (old_symbol)
-          {
-            if (!type_match (new_symbol->value.type, old_symbol->value.type))
-              {
-                printf ("ERROR: Declared and defined function's types don't match\n");
-                printf ("NOTE: '");
-                type_debug_print (new_symbol->value.type);
-                printf ("' and '");
-                type_debug_print (old_symbol->value.type);
-                printf ("'\n");
+/* Sets FTZ and DAZ for the body of 'function' alone: the entry saves
+   MXCSR and sets them, and every return puts the saved value back.
 
-                abort();
-              }
-          }
+   This is best effort. The arithmetic is not 'strictfp', so nothing in
+   the IR orders it against the two 'ldmxcsr' calls, and an optimization
+   may move it outside them. Keeping the function out of line stops the
+   likeliest case, where inlining merges its arithmetic with the
+   caller's. */
+static void
+target_flush_function (LLVMModuleRef module, LLVMValueRef function)
+{
+  LLVMTypeRef i32 = LLVMInt32TypeInContext (context);
+  unsigned noinline = LLVMGetEnumAttributeKindForName ("noinline", 8);
 
-        scope_add (fs, new_symbol);
+  LLVMAddAttributeAtIndex (function, LLVMAttributeFunctionIndex,
+                           LLVMCreateEnumAttribute (context, noinline, 0));
+  LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock (function);
 
-        return ast_t;
-      }
-      break;
-    case AST_FUNCTION:
-      {
-        struct type *result = ast_type_check (ast->child, arena, fs, vs);
+  LLVMPositionBuilderBefore (builder, LLVMGetFirstInstruction (entry));
 
-        struct ast *current = ast->child->child->next;
-        size_t n = 0;
+  LLVMValueRef saved = LLVMBuildAlloca (builder, i32, "mxcsr");
+  LLVMValueRef mode = LLVMBuildAlloca (builder, i32, "mxcsr.flush");
 
-        while (current != NULL)
-          {
-            // struct comptime_variable v;
-            // v.name = current->value.token.value.s;
-            // v.type = result->value.function.argument_t[n];
-            // // printf ("variable, %s, ", v.name);
-            // // type_debug_print (v.type);
-            // // printf ("\n");
-            // variables[variables_n++] = v;
+  target_flush_call (module, "llvm.x86.sse.stmxcsr", saved);
+  LLVMValueRef value = LLVMBuildLoad2 (builder, i32, saved, "");
+  value = LLVMBuildOr (builder, value, LLVMConstInt (i32, 32832, 0), "");
+  LLVMBuildStore (builder, value, mode);
+  target_flush_call (module, "llvm.x86.sse.ldmxcsr", mode);
 
-            struct symbol *symbol;
+  for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock (function); bb != NULL;
+       bb = LLVMGetNextBasicBlock (bb))
+    {
+      LLVMValueRef terminator = LLVMGetBasicBlockTerminator (bb);
 
-            symbol = symbol_create (SYMBOL_TYPE, current->value.token.value.s);
-            symbol->value.type = result->value.function.argument_t[n];
+      if (terminator && LLVMGetInstructionOpcode (terminator) == LLVMRet)
+        {
+          LLVMPositionBuilderBefore (builder, terminator);
+          target_flush_call (module, "llvm.x86.sse.ldmxcsr", saved);
+        }
+    }
+}
 
-            scope_add (vs, symbol);
+/* A function that flushes denormals only does so if the hardware does. On
+   x86-64, '-fdenormal-fp-math=preserve-sign' sets up MXCSR once at startup;
+   the mode is per thread, and threads start with the mode of the one that
+   created them. Without it, each 'flush_denormals' function changes the
+   mode only while it runs, so the rest of the program keeps IEEE
+   denormals. */
+static void
+target_flush (LLVMModuleRef module, const char *triple, int global)
+{
+  if (strncmp (triple, "x86_64", 6) != 0)
+    return;
 
-            current = current->next;
-            n++;
-          }
+  if (!global)
+    {
+      for (LLVMValueRef function = LLVMGetFirstFunction (module);
+           function != NULL; function = LLVMGetNextFunction (function))
+        if (LLVMCountBasicBlocks (function) > 0
+            && LLVMGetStringAttributeAtIndex (function,
+                                              LLVMAttributeFunctionIndex,
+                                              "denormal-fp-math", 16))
+          target_flush_function (module, function);
+
+      return;
+    }
 
-        struct type *return_t = ast_type_check (ast->child->next, arena, fs, vs);
-        ast_type_match (return_t->kind, result->value.function.return_t->kind,
-                        ast->child->next->location);
+  LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRange (
+      TARGET_FLUSH_SOURCE, sizeof (TARGET_FLUSH_SOURCE) - 1, "flush", 0);
+  LLVMModuleRef flush;
+  char *error;
 
-        return result;
-      }
-      break;
-    case AST_PROGRAM:
-      {
-        struct ast *current = ast->child;
-        while (current != NULL)
-          {
-            scope_clear (vs);
-            ast_type_check (current, arena, fs, vs);
-            current = current->next;
-          }
-        return NULL;
-      }
-      break;
+  if (LLVMParseIRInContext (context, buffer, &flush, &error) != 0)
+    {
+      fprintf (stderr, "Error parsing startup routine: %s\n", error);
+      LLVMDisposeMessage (error);
+      exit (1);
     }
 
-  printf ("%s Bad Node\n", ast_type_string (ast->type));
-  abort ();
+  if (LLVMLinkModules2 (module, flush) != 0)
+    {
+      fprintf (stderr, "Error linking startup routine\n");
+      exit (1);
+    }
 }
 
-/* -------------------------------------------------------------------------- */
-
-
-
 int
 main (int argc, char *argv[])
 {
@@ -1064,9 +2722,14 @@ main (int argc, char *argv[])
   */
 
 
-  if (argc < 2)
+  struct options options;
+
+  if (options_parse (&options, argc, argv) != 0)
     {
-      printf ("Usage: %s <file>\n", argv[0]);
+      printf ("Usage: %s [-j threads] [-O0|-O1|-O2|-O3|-Os] [-mcpu=cpu] "
+              "[-mattr=features] [-ffast-math] [-ffp-contract=fast|off] "
+              "[-fdenormal-fp-math=ieee|preserve-sign] <file>\n",
+              argv[0]);
       abort ();
     }
 
@@ -1075,18 +2738,20 @@ main (int argc, char *argv[])
 
   // 1 && 2 == 3
 
-  precedence_table_add ("=", 10);
+  struct precedence_table precedence = { 0 };
 
-  precedence_table_add ("<", 80);
-  precedence_table_add (">", 80);
-  precedence_table_add ("<=", 80);
-  precedence_table_add (">=", 80);
+  precedence_table_add (&precedence, "=", 10, 0);
 
-  precedence_table_add ("+", 90);
-  precedence_table_add ("-", 90);
+  precedence_table_add (&precedence, "<", 80, 0);
+  precedence_table_add (&precedence, ">", 80, 0);
+  precedence_table_add (&precedence, "<=", 80, 0);
+  precedence_table_add (&precedence, ">=", 80, 0);
 
-  precedence_table_add ("*", 100);
-  precedence_table_add ("/", 100);
+  precedence_table_add (&precedence, "+", 90, 0);
+  precedence_table_add (&precedence, "-", 90, 0);
+
+  precedence_table_add (&precedence, "*", 100, 0);
+  precedence_table_add (&precedence, "/", 100, 0);
 
 
   char path_copy[PATH_MAX];
@@ -1094,7 +2759,7 @@ main (int argc, char *argv[])
   char base_copy[PATH_MAX];
 
   // Copy argv[1] to avoid modifying the original string
-  strncpy(path_copy, argv[1], PATH_MAX - 1);
+  strncpy(path_copy, options.input, PATH_MAX - 1);
   path_copy[PATH_MAX - 1] = '\0';
 
   // Extract directory name safely
@@ -1103,7 +2768,7 @@ main (int argc, char *argv[])
   char *dir = dirname(dir_copy);
 
   // Extract base filename safely
-  strncpy(base_copy, argv[1], PATH_MAX - 1);
+  strncpy(base_copy, options.input, PATH_MAX - 1);
   base_copy[PATH_MAX - 1] = '\0';
   char *base = basename(base_copy);
 
@@ -1134,61 +2799,61 @@ main (int argc, char *argv[])
   module = LLVMModuleCreateWithNameInContext ("Main", context);
   builder = LLVMCreateBuilderInContext (context);
 
-  pass_manager = LLVMCreateFunctionPassManagerForModule(module);
-  LLVMAddPromoteMemoryToRegisterPass (pass_manager);  // mem2reg
-  LLVMInitializeFunctionPassManager (pass_manager);
+  struct source source;
+
+  if (source_open (&source, options.input) != 0)
+    {
+      fprintf (stderr, "%s: %s\n", options.input, strerror (errno));
+      return 1;
+    }
 
-  char *buffer = read_file (argv[1]);
+  struct diagnostics diagnostics = {0};
+  struct lexer lexer = lexer_create (source.data, options.input,
+                                     &diagnostics);
 
-  struct arena lexer_arena = {0};
-  struct lexer lexer = lexer_create (buffer, argv[1], &lexer_arena);
+  struct token_stream stream;
+  lexer_tokenize_parallel (&lexer, source.size, options.threads, &stream);
 
-  struct arena parser_arena = {0};
-  struct parser parser = parser_create (&lexer, &parser_arena);
+  struct ast ast = {0};
+  struct parser parser = parser_create (&stream, &precedence, &ast);
 
-  struct ast *ast = parser_parse (&parser);
+  uint32_t root = parser_parse_parallel (&parser, options.threads);
 
-  if (ast_match_error (ast))
+  if (ast_match_error (&ast, root))
     {
-      location_debug_print (ast->location);
-      printf (": fatal-error: %s [SYNTAX]\n", ast->value.error.message);
+      location_debug_print (ast.location[root]);
+      printf (": fatal-error: %s [SYNTAX]\n", ast_error (&ast, root)->message);
 
-      arena_destroy (&lexer_arena);
-      arena_destroy (&parser_arena);
+      ast_destroy (&ast);
 
       exit (1);
     }
   // else
-  //   ast_debug_print (ast, 0);
+  //   ast_debug_print (&ast, root, 0);
 
   printf ("\n");
 
-  struct arena type_check_arena = {0};
-
-  ast_type_check (ast, &type_check_arena, scope_create (NULL), scope_create (NULL));
+  ast_resolve (&ast, root);
+  ast_type_check (&ast, root, options.threads);
   // printf ("-------------------\n");
-  // ast_debug_print (ast, 0);
+  // ast_debug_print (&ast, root, 0);
   // printf ("-------------------\n");
 
-  struct scope *scope;
+  uint8_t *effects = ast_effects (&ast, root, options.flush);
 
-  scope = scope_create (NULL);
-
-  (void)generate (ast, scope);
+  (void)generate (&ast, root, effects, options.fp, options.flush);
+  free (effects);
   if (has_error)
     exit (1);
 
-  arena_destroy (&lexer_arena);
-  arena_destroy (&parser_arena);
-
-  arena_destroy (&type_check_arena);
+  token_stream_destroy (&stream);
+  diagnostics_destroy (&diagnostics);
 
-  arena_destroy (&lexer_arena);
+  ast_destroy (&ast);
 
   // LLVMDumpModule (module);
 
   char *error;
-  LLVMPrintModuleToFile (module, ll_file, &error);
 
   LLVMInitializeAllTargetInfos();
   LLVMInitializeAllTargets();
@@ -1206,14 +2871,20 @@ main (int argc, char *argv[])
       exit(1);
   }
 
+  char *cpu = target_cpu (&options);
+  char *features = target_features (&options);
+
+  target_stamp (module, cpu, features);
+  target_flush (module, triple, options.flush);
+
   // Create target machine
   LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
       target,
       triple,
-      "",     // CPU
-      "",     // Features
-      LLVMCodeGenLevelDefault,
-      LLVMRelocDefault,
+      cpu,
+      features,
+      OPTIONS_LEVEL_CODEGEN[options.level],
+      LLVMRelocPIC,
       LLVMCodeModelDefault
   );
 
@@ -1234,6 +2905,23 @@ main (int argc, char *argv[])
 
   LLVMDisposeMessage(error);
 
+  // Optimize with the standard pipeline of the level, using the target
+  // machine's cost model
+  LLVMPassBuilderOptionsRef pass_options = LLVMCreatePassBuilderOptions ();
+  LLVMErrorRef pass_error
+      = LLVMRunPasses (module, OPTIONS_LEVEL_PIPELINE[options.level],
+                       target_machine, pass_options);
+  LLVMDisposePassBuilderOptions (pass_options);
+
+  if (pass_error != NULL) {
+      char *message = LLVMGetErrorMessage(pass_error);
+      fprintf(stderr, "Error running passes: %s\n", message);
+      LLVMDisposeErrorMessage(message);
+      exit(1);
+  }
+
+  LLVMPrintModuleToFile (module, ll_file, &error);
+
   // Emit object file
   if (LLVMTargetMachineEmitToFile(
           target_machine,
@@ -1260,17 +2948,22 @@ main (int argc, char *argv[])
   // Clean up
   LLVMDisposeTargetMachine(target_machine);
   LLVMDisposeMessage(triple);
+  free(cpu);
+  free(features);
   LLVMDisposeTargetData(data_layout);
 
   LLVMDisposeBuilder (builder);
   LLVMDisposeModule (module);
   LLVMContextDispose (context);
 
-  precedence_table_destroy ();
+  precedence_table_destroy (&precedence);
+  type_destroy ();
+  intern_destroy ();
+  file_destroy_all ();
 
   printf ("3 files generated: %s, %s, %s\n", ll_file, s_file, o_file);
 
-  free (buffer);
+  source_close (&source);
 
   return 0;
 }
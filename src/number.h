@@ -0,0 +1,11 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+/* Parse the numeric literal at the start of a string into the nearest
+   double. Accepted forms are decimal ('12', '1.5', '2.5e-3'), binary
+   ('0b101'), octal ('0o17') and hexadecimal ('0xFF', '0x1.8p3') literals,
+   with '_' allowed between two digits as a separator. Returns the first
+   character after the literal, or NULL if the literal is malformed. */
+const char *number_parse (const char *, double *);
+
+#endif // NUMBER_H
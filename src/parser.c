@@ -1,65 +1,127 @@
 #include "ast.h"
+#include "intern.h"
 #include "parser.h"
-#include "string.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <stdio.h>
 
 struct parser
-parser_create (struct lexer *lexer, struct arena *arena)
+parser_create (const struct token_stream *stream,
+               struct precedence_table *precedence, struct ast *ast)
 {
   struct parser parser;
 
-  parser.lexer = lexer;
-  parser.arena = arena;
+  parser.stream = stream;
+  parser.index = 0;
+  parser.precedence = precedence;
+  parser.ast = ast;
+  parser.statement = 0;
+  parser.assign = intern ("=");
+  parser.fast_math = intern ("fast_math");
+  parser.fp_contract = intern ("fp_contract");
+  parser.flush_denormals = intern ("flush_denormals");
+
+  for (size_t i = 0; i < AST_OPERATOR_USER; ++i)
+    parser.operators[i] = intern (ast_operator_string (i));
 
   return parser;
 }
 
-struct precedence
+static void
+precedence_table_grow (struct precedence_table *table)
 {
-  const char *key;
-  double precedence;
-};
+  size_t capacity = table->capacity ? table->capacity * 2 : 64;
+  struct precedence *entries = calloc (capacity, sizeof (struct precedence));
+
+  for (size_t i = 0; i < table->capacity; ++i)
+    {
+      struct precedence entry = table->entries[i];
+
+      if (!entry.key)
+        continue;
+
+      size_t j = intern_hash (entry.key) & (capacity - 1);
+      while (entries[j].key)
+        j = (j + 1) & (capacity - 1);
 
-static struct precedence PRECEDENCE_TABLE[128];
-size_t precedence_n = 0;
+      entries[j] = entry;
+    }
+
+  free (table->entries);
+
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+/* Slot of interned 'key': its entry, or the empty slot it would take. */
+static struct precedence *
+precedence_table_slot (const struct precedence_table *table, const char *key)
+{
+  size_t mask = table->capacity - 1;
+  size_t i = intern_hash (key) & mask;
+
+  while (table->entries[i].key && table->entries[i].key != key)
+    i = (i + 1) & mask;
+
+  return &table->entries[i];
+}
 
 void
-precedence_table_add (const char *key, double precedence)
+precedence_table_add (struct precedence_table *table, const char *key,
+                      double precedence, uint32_t statement)
 {
-  struct precedence p;
+  if (table->frozen)
+    return;
 
-  p.key = string_copy (key, NULL);
-  p.precedence = precedence;
+  if (table->size * 2 >= table->capacity)
+    precedence_table_grow (table);
 
-  PRECEDENCE_TABLE[precedence_n++] = p;
+  struct precedence *slot = precedence_table_slot (table, intern (key));
+
+  /* The first declaration of an operator decides its precedence. */
+  if (slot->key)
+    return;
+
+  slot->key = intern (key);
+  slot->precedence = precedence;
+  slot->statement = statement;
+  table->size++;
 }
 
 void
-precedence_table_destroy ()
+precedence_table_destroy (struct precedence_table *table)
 {
-  for (size_t i = 0; i < precedence_n; ++i)
-    free ((void *)PRECEDENCE_TABLE[i].key);
+  free (table->entries);
+
+  table->entries = NULL;
+  table->capacity = 0;
+  table->size = 0;
+  table->frozen = 0;
 }
 
-static struct precedence
-parser_query_precedence_table (struct token token)
+static double
+parser_query_precedence (struct parser *parser, const char *name)
 {
-  if (!token_match (token, TOKEN_IDENTIFIER))
-    goto invalid;
+  if (!parser->precedence->size)
+    return 0.0;
 
-  for (size_t i = 0; i < precedence_n; ++i)
-    {
-      struct precedence current = PRECEDENCE_TABLE[i];
+  struct precedence *slot = precedence_table_slot (parser->precedence, name);
 
-      if (strcmp (current.key, token.value.s) == 0)
-        return current;
-    }
+  if (!slot->key || slot->statement > parser->statement)
+    return 0.0;
 
-invalid:
-  return (struct precedence) { 0 };
+  return slot->precedence;
+}
+
+static double
+parser_query_precedence_table (struct parser *parser, struct token token)
+{
+  if (!token_match (token, TOKEN_IDENTIFIER))
+    return 0.0;
+
+  return parser_query_precedence (parser, token.value.s);
 }
 
 static int
@@ -74,27 +136,30 @@ parser_match_error (struct parser *parser)
   return parser_match (parser, TOKEN_ERROR);
 }
 
-static struct ast *
+static uint32_t
 parser_error_from_token (struct parser *parser, struct token token,
                          struct location location)
 {
-  return ast_create_e (token.value.error, location, parser->arena);
+  struct error error = parser->stream->diagnostics->errors[token.value.error];
+
+  return ast_create_e (parser->ast, error, location);
 }
 
-static struct ast *
+static uint32_t
 parser_error_from_current (struct parser *parser)
 {
   return parser_error_from_token (parser, parser->current, parser->location);
 }
 
-static struct ast *
+static uint32_t
 parser_error_expect_base (struct parser *parser, const char *a, const char *b)
 {
-  return ast_create_e (error_create ("expected `%s`, got `%s`", a, b),
-                       parser->location, parser->arena);
+  return ast_create_e (parser->ast,
+                       error_create ("expected `%s`, got `%s`", a, b),
+                       parser->location);
 }
 
-static struct ast *
+static uint32_t
 parser_error_expect_token (struct parser *parser, enum token_type type)
 {
   const char *a = token_type_string (type);
@@ -102,31 +167,36 @@ parser_error_expect_token (struct parser *parser, enum token_type type)
   return parser_error_expect_base (parser, a, b);
 }
 
+/* Token 'k' places after the current one. The stream ends with
+   TOKEN_NOTHING or TOKEN_ERROR, which is returned for any 'k' past it. */
+static struct token
+parser_peek (struct parser *parser, size_t k)
+{
+  size_t last = parser->stream->size - 1;
+  size_t index = parser->index + k - 1;
+
+  return parser->stream->tokens[index < last ? index : last];
+}
+
 static int
 parser_advance (struct parser *parser)
 {
-  /* 'lexer_next' might return token of type 'TOKEN_ERROR'. */
-  parser->current = lexer_next (parser->lexer);
-  parser->location = parser->current.location;
+  /* The stream might end with a token of type 'TOKEN_ERROR'. */
+  parser->current = parser_peek (parser, 1);
+  parser->index++;
+  parser->location = location_create (parser->stream->file,
+                                      parser->current.offset);
   // if (parser->current.type == TOKEN_IDENTIFIER)
   //   printf ("'%s'\n", parser->current.value.s);
   return parser_match_error (parser);
 }
 
-struct ast *parser_parse_program(struct parser *);
-struct ast *parser_parse_statement(struct parser *);
-struct ast *parser_parse_top_level_statement(struct parser *);
-struct ast *parser_parse_function_prototype(struct parser *);
-struct ast *parser_parse_expression(struct parser *);
-struct ast *parser_parse_primary(struct parser *);
-struct ast *parser_parse_identifier_expression(struct parser *);
-struct ast *parser_parse_number_expression(struct parser *);
-struct ast *parser_parse_group_expression(struct parser *);
-struct ast *parser_parse_compound_expression (struct parser *);
-struct ast *parser_parse_conditional_expression (struct parser *);
-
-struct ast *parser_parse_while (struct parser *);
-struct ast *parser_parse_declaration_expression (struct parser *);
+uint32_t parser_parse_program(struct parser *);
+uint32_t parser_parse_statement(struct parser *);
+uint32_t parser_parse_top_level_statement(struct parser *);
+uint32_t parser_parse_function_prototype(struct parser *);
+uint32_t parser_parse_expression(struct parser *);
+uint32_t parser_parse_number_expression(struct parser *);
 
 // TODO: HANDLE ERRORS!
 struct type *
@@ -136,13 +206,13 @@ parser_parse_type_primary (struct parser *parser)
     {
     case TOKEN_VOID:
       parser_advance (parser);
-      return type_create (TYPE_VOID, parser->arena);
+      return type_create (TYPE_VOID);
     case TOKEN_F64:
       parser_advance (parser);
-      return type_create (TYPE_F64, parser->arena);
+      return type_create (TYPE_F64);
     case TOKEN_BOOL:
       parser_advance (parser);
-      return type_create (TYPE_BOOL, parser->arena);
+      return type_create (TYPE_BOOL);
     default:
       printf ("Expected F64 or Bool\n");
       abort();
@@ -162,8 +232,9 @@ parser_parse_type (struct parser *parser)
 
         size_t capacity = 4;
 
+        struct type *arguments[4];
         struct type_function function;
-        function.argument_t = calloc (capacity, sizeof (struct type *));
+        function.argument_t = arguments;
         function.argument_n = 0;
 
         if (!parser_match (parser, TOKEN_RPAREN))
@@ -175,8 +246,17 @@ parser_parse_type (struct parser *parser)
 
               if (function.argument_n >= capacity)
                 {
+                  struct type **argument_t;
+
                   capacity *= 2;
-                  function.argument_t = realloc (function.argument_t, capacity * sizeof (struct type *));
+                  argument_t = malloc (capacity * sizeof (struct type *));
+                  memcpy (argument_t, function.argument_t,
+                          function.argument_n * sizeof (struct type *));
+
+                  if (function.argument_t != arguments)
+                    free (function.argument_t);
+
+                  function.argument_t = argument_t;
                 }
 
               function.argument_t[function.argument_n++] = argument;
@@ -197,23 +277,30 @@ parser_parse_type (struct parser *parser)
         function.return_t = parser_parse_type_primary (parser);
 
         function.variadic = 0;
-        return type_create_f (function, parser->arena);
+
+        /* The interner copies the arguments. */
+        struct type *type = type_create_f (function);
+
+        if (function.argument_t != arguments)
+          free (function.argument_t);
+
+        return type;
       }
     default:
       return parser_parse_type_primary (parser);
     }
 }
 
-struct ast *
+uint32_t
 parser_parse_identifier (struct parser *parser)
 {
   if (!parser_match (parser, TOKEN_IDENTIFIER))
     return parser_error_expect_token (parser, TOKEN_IDENTIFIER);
 
-  struct ast *result;
+  uint32_t result;
 
-  result = ast_create (AST_IDENTIFIER, parser->location, parser->arena);
-  result->value.token = parser->current;
+  result = ast_create (parser->ast, AST_IDENTIFIER, parser->location);
+  parser->ast->value[result].s = parser->current.value.s;
 
   if (parser_advance (parser))
     return parser_error_from_current (parser);
@@ -221,403 +308,602 @@ parser_parse_identifier (struct parser *parser)
   return result;
 }
 
-struct ast *
-parser_parse_primary (struct parser *parser)
+uint32_t
+parser_parse_number_expression (struct parser *parser)
 {
-  struct ast *expression;
-
-  switch (parser->current.type)
-    {
-    case TOKEN_IDENTIFIER:
-      expression = parser_parse_identifier_expression (parser);
-      break;
-    case TOKEN_NUMBER:
-      expression = parser_parse_number_expression (parser);
-      break;
-    case TOKEN_LPAREN:
-      expression = parser_parse_group_expression (parser);
-      break;
-    case TOKEN_LBRACE:
-      expression = parser_parse_compound_expression (parser);
-      break;
-    case TOKEN_IF:
-      expression = parser_parse_conditional_expression (parser);
-      break;
-    default:
-      {
-        const char *b = token_type_string (parser->current.type);
-        return parser_error_expect_base (parser, "expression", b);
-      }
-    }
+  if (!parser_match (parser, TOKEN_NUMBER))
+    return parser_error_expect_token (parser, TOKEN_NUMBER);
 
-  if (!parser_match (parser, TOKEN_AS))
-    return expression;
+  uint32_t result;
 
-  struct ast *cast = ast_create (AST_CAST, parser->location, parser->arena);
+  result = ast_create (parser->ast, AST_NUMBER, parser->location);
+  parser->ast->value[result].f = parser->current.value.f;
 
   if (parser_advance (parser))
     return parser_error_from_current (parser);
 
-  struct type *type = parser_parse_type_primary (parser);
-
-  ast_append (cast, expression);
+  parser->ast->expr_type[result] = type_create (TYPE_F64);
 
-  cast->expr_type = type;
+  return result;
+}
 
-  return cast;
+/* Expressions are parsed without native recursion. Every construct that
+   nests expressions keeps its progress in a frame on an explicit stack,
+   and the operands and operators of an expression being climbed sit on
+   the tree's scratch stack, next to the children of unfinished nodes. */
 
-}
+/* No expression is finished yet, or the next one should be started. */
+#define PARSER_NONE UINT32_MAX
 
-struct ast *
-parser_parse_conditional_expression (struct parser *parser)
+enum parser_frame_type
 {
-  struct location l_result = parser->location;
-
-  if (!parser_match (parser, TOKEN_IF))
-    return parser_error_expect_token (parser, TOKEN_IF);
+  PARSER_FRAME_EXPRESSION,
+  PARSER_FRAME_GROUP,
+  PARSER_FRAME_CALL,
+  PARSER_FRAME_CONDITIONAL,
+  PARSER_FRAME_COMPOUND,
+  PARSER_FRAME_WHILE,
+  PARSER_FRAME_DECLARATION,
+};
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+struct parser_frame
+{
+  enum parser_frame_type type;
+  int state;
+  uint32_t node;
+  /* Where the frame's operands or children start on the scratch stack. */
+  uint32_t mark;
+  struct location location;
+  struct location child;
+};
 
-  struct ast *cond_node;
-  struct ast *then_node;
-  struct ast *else_node;
-  struct ast *result;
+struct parser_stack
+{
+  struct parser_frame *frames;
+  size_t size;
+  size_t capacity;
+};
 
-  struct location l_cond = parser->location;
+static struct parser_frame *
+parser_push (struct parser *parser, struct parser_stack *stack,
+             enum parser_frame_type type)
+{
+  if (stack->size >= stack->capacity)
+    {
+      stack->capacity = stack->capacity ? stack->capacity * 2 : 16;
+      stack->frames = realloc (stack->frames,
+                               stack->capacity * sizeof (struct parser_frame));
+    }
 
-  cond_node = parser_parse_expression (parser);
-  if (ast_match_error (cond_node))
-    return cond_node;
+  struct parser_frame *frame = &stack->frames[stack->size++];
 
-  if (!parser_match (parser, TOKEN_THEN))
-    return parser_error_expect_token (parser, TOKEN_THEN);
+  frame->type = type;
+  frame->state = 0;
+  frame->node = PARSER_NONE;
+  frame->mark = ast_mark (parser->ast);
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+  return frame;
+}
 
-  struct location l_then = parser->location;
+static struct parser_frame *
+parser_top (struct parser_stack *stack)
+{
+  return &stack->frames[stack->size - 1];
+}
 
-  then_node = parser_parse_expression (parser);
-  if (ast_match_error (then_node))
-    return then_node;
+static int
+parser_fail (uint32_t error, uint32_t *value)
+{
+  *value = error;
+  return 1;
+}
 
-  if (!parser_match (parser, TOKEN_ELSE))
-    return parser_error_expect_token (parser, TOKEN_ELSE);
+/* The built-in operator spelled by interned 's', or AST_OPERATOR_USER. */
+static enum ast_operator
+parser_classify (const struct parser *parser, const char *s)
+{
+  for (size_t i = 0; i < AST_OPERATOR_USER; ++i)
+    if (parser->operators[i] == s)
+      return i;
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+  return AST_OPERATOR_USER;
+}
 
-  struct location l_else = parser->location;
+/* Replace the topmost 'left operator right' on the scratch stack by one
+   binary node. */
+static void
+parser_reduce (struct parser *parser)
+{
+  struct ast *ast = parser->ast;
 
-  else_node = parser_parse_expression (parser);
-  if (ast_match_error (else_node))
-    return else_node;
+  uint32_t right = ast_pop (ast);
+  uint32_t middle = ast_pop (ast);
+  uint32_t left = ast_pop (ast);
 
-  result = ast_create (AST_CONDITIONAL, parser->location, parser->arena);
+  uint32_t t = ast_create (ast, AST_BINARY, ast->location[left]);
 
-  ast_append (result, cond_node);
-  ast_append (result, then_node);
-  ast_append (result, else_node);
+  ast->state[t] = parser_classify (parser, ast->value[middle].s);
 
-  result->location = l_result;
-  cond_node->location = l_cond;
-  then_node->location = l_then;
-  else_node->location = l_else;
+  uint32_t mark = ast_mark (ast);
+  ast_append (ast, middle);
+  ast_append (ast, left);
+  ast_append (ast, right);
+  ast_attach (ast, t, mark);
 
-  return result;
+  ast_append (ast, t);
 }
 
-struct ast *
-parser_parse_compound_expression (struct parser *parser)
+/* Start a primary expression. Leaves '*value' at PARSER_NONE if a frame
+   was pushed for it. */
+static int
+parser_begin_primary (struct parser *parser, struct parser_stack *stack,
+                      uint32_t *value)
 {
-  if (!parser_match (parser, TOKEN_LBRACE))
-    return parser_error_expect_token (parser, TOKEN_LBRACE);
+  struct ast *ast = parser->ast;
+  struct parser_frame *frame;
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+  switch (parser->current.type)
+    {
+    case TOKEN_IDENTIFIER:
+      {
+        uint32_t identifier = parser_parse_identifier (parser);
+        if (ast_match_error (ast, identifier))
+          return parser_fail (identifier, value);
+
+        if (!parser_match (parser, TOKEN_LPAREN))
+          {
+            *value = identifier;
+            return 0;
+          }
 
-  struct ast *result;
+        if (parser_advance (parser))
+          return parser_fail (parser_error_from_current (parser), value);
 
-  result = ast_create (AST_COMPOUND, parser->location, parser->arena);
+        frame = parser_push (parser, stack, PARSER_FRAME_CALL);
+        frame->node = ast_create (ast, AST_CALL, parser->location);
 
-  int void_ = 0;
+        ast_append (ast, identifier);
 
-  if (parser_match (parser, TOKEN_RBRACE))
-    void_ = 1;
-  else
-    while (1)
-      {
-        if (parser_match (parser, TOKEN_RBRACE))
+        if (!parser_match (parser, TOKEN_RPAREN))
           {
-            void_ = 1;
-            break;
+            parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+            return 0;
           }
 
-        struct ast *expression;
+        if (parser_advance (parser))
+          return parser_fail (parser_error_from_current (parser), value);
 
-        expression = parser_parse_while (parser);
-        if (ast_match_error (expression))
-          return expression;
+        ast_attach (ast, frame->node, frame->mark);
 
-        ast_append (result, expression);
+        *value = frame->node;
+        stack->size--;
+        return 0;
+      }
+    case TOKEN_NUMBER:
+      *value = parser_parse_number_expression (parser);
+      if (ast_match_error (ast, *value))
+        return 1;
+      return 0;
+    case TOKEN_LPAREN:
+      frame = parser_push (parser, stack, PARSER_FRAME_GROUP);
+      frame->location = parser->location;
 
-        if (parser_match (parser, TOKEN_RBRACE))
-          break;
+      if (parser_advance (parser))
+        return parser_fail (parser_error_from_current (parser), value);
 
-        if (!parser_match (parser, TOKEN_SEMICOLON))
-          return parser_error_expect_token (parser, TOKEN_RBRACE);
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    case TOKEN_LBRACE:
+      {
+        if (parser_advance (parser))
+          return parser_fail (parser_error_from_current (parser), value);
+
+        uint32_t result = ast_create (ast, AST_COMPOUND, parser->location);
+
+        if (!parser_match (parser, TOKEN_RBRACE))
+          {
+            frame = parser_push (parser, stack, PARSER_FRAME_COMPOUND);
+            frame->node = result;
+            return 0;
+          }
 
         if (parser_advance (parser))
-          return parser_error_from_current (parser);
+          return parser_fail (parser_error_from_current (parser), value);
+
+        ast->state[result] = 1;
+
+        *value = result;
+        return 0;
       }
+    case TOKEN_IF:
+      frame = parser_push (parser, stack, PARSER_FRAME_CONDITIONAL);
+      frame->location = parser->location;
 
-  if (!parser_match (parser, TOKEN_RBRACE))
-    return parser_error_expect_token (parser, TOKEN_RBRACE);
+      if (parser_advance (parser))
+        return parser_fail (parser_error_from_current (parser), value);
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+      frame->child = parser->location;
 
-  result->state = void_;
-  return result;
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    default:
+      {
+        const char *b = token_type_string (parser->current.type);
+        return parser_fail (parser_error_expect_base (parser, "expression",
+                                                      b),
+                            value);
+      }
+    }
 }
 
-struct ast *
-parser_parse_identifier_expression (struct parser *parser)
+/* Start an entry of a compound expression: a while loop, a declaration or
+   an expression. */
+static int
+parser_begin_statement (struct parser *parser, struct parser_stack *stack,
+                        uint32_t *value)
 {
-  struct ast *identifier;
+  struct ast *ast = parser->ast;
 
-  identifier = parser_parse_identifier (parser);
-  if (ast_match_error (identifier))
-    return identifier;
+  if (parser_match (parser, TOKEN_WHILE))
+    {
+      parser_push (parser, stack, PARSER_FRAME_WHILE);
 
-  if (!parser_match (parser, TOKEN_LPAREN))
-    return identifier;
+      if (parser_advance (parser))
+        return parser_fail (parser_error_from_current (parser), value);
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    }
 
-  struct ast *result;
+  if (!parser_match (parser, TOKEN_IDENTIFIER)
+      || parser_peek (parser, 1).type != TOKEN_COLON)
+    {
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    }
 
-  result = ast_create (AST_CALL, parser->location, parser->arena);
+  uint32_t name = parser_parse_identifier (parser);
+  if (ast_match_error (ast, name))
+    return parser_fail (name, value);
 
-  ast_append (result, identifier);
+  if (parser_advance (parser))
+    return parser_fail (parser_error_from_current (parser), value);
 
-  if (!parser_match (parser, TOKEN_RPAREN))
-    while (1)
-      {
-        struct ast *argument;
+  struct type *type = parser_parse_type_primary (parser);
 
-        argument = parser_parse_expression (parser);
-        if (ast_match_error (argument))
-          return argument;
+  uint32_t result = ast_create (ast, AST_DECLARATION, parser->location);
 
-        ast_append (result, argument);
+  ast->expr_type[result] = type;
 
-        if (parser_match (parser, TOKEN_RPAREN))
-          break;
+  struct parser_frame *frame = parser_push (parser, stack,
+                                            PARSER_FRAME_DECLARATION);
+  frame->node = result;
 
-        if (!parser_match (parser, TOKEN_COMMA))
-          return parser_error_expect_token (parser, TOKEN_RPAREN);
+  ast_append (ast, name);
 
-        if (parser_advance (parser))
-          return parser_error_from_current (parser);
-      }
+  if (!token_match_string (parser->current, parser->assign))
+    {
+      ast_attach (ast, result, frame->mark);
 
-  if (!parser_match (parser, TOKEN_RPAREN))
-    return parser_error_expect_token (parser, TOKEN_RPAREN);
+      *value = result;
+      stack->size--;
+      return 0;
+    }
 
   if (parser_advance (parser))
-    return parser_error_from_current (parser);
+    return parser_fail (parser_error_from_current (parser), value);
 
-  return result;
+  parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+  return 0;
 }
 
-struct ast *
-parser_parse_number_expression (struct parser *parser)
+/* Precedence climbing: an operator first reduces every operator on the
+   stack that binds at least as tightly, which keeps operators of equal
+   precedence left-associative. */
+static int
+parser_step_expression (struct parser *parser, struct parser_stack *stack,
+                        uint32_t *value)
 {
-  if (!parser_match (parser, TOKEN_NUMBER))
-    return parser_error_expect_token (parser, TOKEN_NUMBER);
+  struct ast *ast = parser->ast;
 
-  struct ast *result;
+  if (*value == PARSER_NONE)
+    {
+      if (parser_begin_primary (parser, stack, value))
+        return 1;
 
-  result = ast_create (AST_NUMBER, parser->location, parser->arena);
-  result->value.token = parser->current;
+      if (*value == PARSER_NONE)
+        return 0;
+    }
 
-  if (parser_advance (parser))
-    return parser_error_from_current (parser);
+  if (parser_match (parser, TOKEN_AS))
+    {
+      uint32_t cast = ast_create (ast, AST_CAST, parser->location);
+
+      if (parser_advance (parser))
+        return parser_fail (parser_error_from_current (parser), value);
 
-  result->expr_type = type_create (TYPE_F64, parser->arena);
+      struct type *type = parser_parse_type_primary (parser);
 
-  return result;
+      uint32_t mark = ast_mark (ast);
+      ast_append (ast, *value);
+      ast_attach (ast, cast, mark);
+
+      ast->expr_type[cast] = type;
+
+      *value = cast;
+    }
+
+  struct parser_frame *frame = parser_top (stack);
+
+  ast_append (ast, *value);
+  *value = PARSER_NONE;
+
+  double p = parser_query_precedence_table (parser, parser->current);
+
+  if (p > 0.0)
+    {
+      while (ast->scratch_size - frame->mark >= 3)
+        {
+          uint32_t top = ast->scratch[ast->scratch_size - 2];
+
+          if (parser_query_precedence (parser, ast->value[top].s) < p)
+            break;
+
+          parser_reduce (parser);
+        }
+
+      uint32_t middle = parser_parse_identifier (parser);
+      if (ast_match_error (ast, middle))
+        return parser_fail (middle, value);
+
+      ast_append (ast, middle);
+      return 0;
+    }
+
+  while (ast->scratch_size - frame->mark >= 3)
+    parser_reduce (parser);
+
+  *value = ast_pop (ast);
+  stack->size--;
+  return 0;
 }
 
-struct ast *
-parser_parse_group_expression (struct parser *parser)
+static int
+parser_step_group (struct parser *parser, struct parser_stack *stack,
+                   uint32_t *value)
 {
-  struct location location = parser->location;
+  struct parser_frame *frame = parser_top (stack);
 
-  if (!parser_match (parser, TOKEN_LPAREN))
-    return parser_error_expect_token (parser, TOKEN_LPAREN);
+  if (!parser_match (parser, TOKEN_RPAREN))
+    return parser_fail (parser_error_expect_token (parser, TOKEN_RPAREN),
+                        value);
 
   if (parser_advance (parser))
-    return parser_error_from_current (parser);
+    return parser_fail (parser_error_from_current (parser), value);
 
-  struct ast *result;
+  parser->ast->location[*value] = frame->location;
+  stack->size--;
+  return 0;
+}
 
-  result = parser_parse_expression (parser);
-  if (ast_match_error (result))
-    return result;
+static int
+parser_step_call (struct parser *parser, struct parser_stack *stack,
+                  uint32_t *value)
+{
+  struct ast *ast = parser->ast;
+  struct parser_frame *frame = parser_top (stack);
+
+  ast_append (ast, *value);
 
   if (!parser_match (parser, TOKEN_RPAREN))
-    return parser_error_expect_token (parser, TOKEN_RPAREN);
+    {
+      if (!parser_match (parser, TOKEN_COMMA))
+        return parser_fail (parser_error_expect_token (parser, TOKEN_RPAREN),
+                            value);
+
+      if (parser_advance (parser))
+        return parser_fail (parser_error_from_current (parser), value);
+
+      *value = PARSER_NONE;
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    }
 
   if (parser_advance (parser))
-    return parser_error_from_current (parser);
+    return parser_fail (parser_error_from_current (parser), value);
 
-  result->location = location;
-  return result;
+  ast_attach (ast, frame->node, frame->mark);
+
+  *value = frame->node;
+  stack->size--;
+  return 0;
 }
 
-struct ast *
-parser_parse_expression_base (struct parser *parser, double previous)
+/* 'if' condition 'then' expression 'else' expression. */
+static int
+parser_step_conditional (struct parser *parser, struct parser_stack *stack,
+                         uint32_t *value)
 {
-  struct ast *left;
+  static const enum token_type NEXT[] = { TOKEN_THEN, TOKEN_ELSE };
 
-  left = parser_parse_primary (parser);
-  if (ast_match_error (left))
-    return left;
+  struct ast *ast = parser->ast;
+  struct parser_frame *frame = parser_top (stack);
 
-  struct precedence p;
-  p = parser_query_precedence_table (parser->current);
+  ast->location[*value] = frame->child;
+  ast_append (ast, *value);
 
-  while (p.precedence > previous)
+  if (frame->state < 2)
     {
-      struct ast *middle;
-
-      middle = parser_parse_identifier (parser);
-      if (ast_match_error (middle))
-        return middle;
+      enum token_type next = NEXT[frame->state++];
 
-      struct ast *right;
+      if (!parser_match (parser, next))
+        return parser_fail (parser_error_expect_token (parser, next), value);
 
-      right = parser_parse_expression_base (parser, p.precedence);
-      if (ast_match_error (right))
-        return right;
+      if (parser_advance (parser))
+        return parser_fail (parser_error_from_current (parser), value);
 
-      struct ast *t;
-      t = ast_create (AST_BINARY, left->location, parser->arena);
+      frame->child = parser->location;
 
-      ast_append (t, middle);
-      ast_append (t, left);
-      ast_append (t, right);
+      *value = PARSER_NONE;
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    }
 
-      left = t;
+  uint32_t result = ast_create (ast, AST_CONDITIONAL, frame->location);
 
-      p = parser_query_precedence_table (parser->current);
-    }
+  ast_attach (ast, result, frame->mark);
 
-  return left;
+  *value = result;
+  stack->size--;
+  return 0;
 }
 
-struct ast *
-parser_parse_expression (struct parser *parser)
+static int
+parser_step_compound (struct parser *parser, struct parser_stack *stack,
+                      uint32_t *value)
 {
-  struct ast *expression = parser_parse_expression_base (parser, 0.0);
-  // if (ast_match_error (expression))
-  return expression;
-}
+  struct ast *ast = parser->ast;
+  struct parser_frame *frame = parser_top (stack);
 
-struct ast *
-parser_parse_while (struct parser *parser)
-{
-  if (parser_match (parser, TOKEN_WHILE))
-    {
-      if (parser_advance (parser))
-        return parser_error_from_current (parser);
+  if (*value == PARSER_NONE)
+    return parser_begin_statement (parser, stack, value);
 
-      struct ast *cond = parser_parse_expression (parser);
-      if (ast_match_error (cond))
-        return cond;
+  ast_append (ast, *value);
 
-      if (!parser_match (parser, TOKEN_DO))
-        return parser_error_expect_token (parser, TOKEN_DO);
+  int void_ = 0;
+
+  if (!parser_match (parser, TOKEN_RBRACE))
+    {
+      if (!parser_match (parser, TOKEN_SEMICOLON))
+        return parser_fail (parser_error_expect_token (parser, TOKEN_RBRACE),
+                            value);
 
       if (parser_advance (parser))
-        return parser_error_from_current (parser);
+        return parser_fail (parser_error_from_current (parser), value);
 
-      struct ast *body = parser_parse_expression (parser);
-      if (ast_match_error (body))
-        return body;
+      if (!parser_match (parser, TOKEN_RBRACE))
+        {
+          *value = PARSER_NONE;
+          return 0;
+        }
 
-      struct ast *result = ast_create (AST_WHILE, parser->location,
-                                       parser->arena);
+      void_ = 1;
+    }
 
-      ast_append (result, cond);
-      ast_append (result, body);
+  if (parser_advance (parser))
+    return parser_fail (parser_error_from_current (parser), value);
 
-      return result;
-    }
+  ast_attach (ast, frame->node, frame->mark);
+  ast->state[frame->node] = void_;
 
-  return parser_parse_declaration_expression (parser);
+  *value = frame->node;
+  stack->size--;
+  return 0;
 }
 
-struct ast *
-parser_parse_declaration_expression (struct parser *parser)
+/* 'while' condition 'do' expression. */
+static int
+parser_step_while (struct parser *parser, struct parser_stack *stack,
+                   uint32_t *value)
 {
-  if (parser_match (parser, TOKEN_IDENTIFIER))
-    {
-      struct token peek = lexer_peek (parser->lexer);
+  struct ast *ast = parser->ast;
+  struct parser_frame *frame = parser_top (stack);
 
-      if (peek.type != TOKEN_COLON)
-        return parser_parse_expression (parser);
+  ast_append (ast, *value);
 
-      struct ast *name = parser_parse_identifier (parser);
-      if (ast_match_error (name))
-        return name;
+  if (frame->state++ == 0)
+    {
+      if (!parser_match (parser, TOKEN_DO))
+        return parser_fail (parser_error_expect_token (parser, TOKEN_DO),
+                            value);
 
       if (parser_advance (parser))
-        return parser_error_from_current (parser);
+        return parser_fail (parser_error_from_current (parser), value);
 
-      struct type *type = parser_parse_type_primary (parser);
+      *value = PARSER_NONE;
+      parser_push (parser, stack, PARSER_FRAME_EXPRESSION);
+      return 0;
+    }
 
-      struct ast *result = ast_create (AST_DECLARATION, parser->location,
-                                       parser->arena);
+  uint32_t result = ast_create (ast, AST_WHILE, parser->location);
 
-      result->expr_type = type;
-      ast_append (result, name);
+  ast_attach (ast, result, frame->mark);
 
-      if (!parser_match (parser, TOKEN_IDENTIFIER) ||
-          (parser_match (parser, TOKEN_IDENTIFIER) &&
-           strcmp (parser->current.value.s, "=") != 0))
-        return result;
+  *value = result;
+  stack->size--;
+  return 0;
+}
 
-      if (parser_advance (parser))
-        return parser_error_from_current (parser);
+static int
+parser_step_declaration (struct parser *parser, struct parser_stack *stack,
+                         uint32_t *value)
+{
+  struct ast *ast = parser->ast;
+  struct parser_frame *frame = parser_top (stack);
+
+  ast_append (ast, *value);
+  ast_attach (ast, frame->node, frame->mark);
 
-      struct ast *value = parser_parse_expression (parser);
-      if (ast_match_error (value))
-        return value;
+  *value = frame->node;
+  stack->size--;
+  return 0;
+}
+
+uint32_t
+parser_parse_expression (struct parser *parser)
+{
+  struct parser_stack stack = { 0 };
+  uint32_t value = PARSER_NONE;
+  int error = 0;
 
-      ast_append (result, value);
+  parser_push (parser, &stack, PARSER_FRAME_EXPRESSION);
 
-      return result;
-    }
+  /* Each step either finishes the top frame and leaves its node in
+     'value' for the frame below, or pushes a frame for a nested
+     expression. */
+  while (!error && stack.size > 0)
+    switch (parser_top (&stack)->type)
+      {
+      case PARSER_FRAME_EXPRESSION:
+        error = parser_step_expression (parser, &stack, &value);
+        break;
+      case PARSER_FRAME_GROUP:
+        error = parser_step_group (parser, &stack, &value);
+        break;
+      case PARSER_FRAME_CALL:
+        error = parser_step_call (parser, &stack, &value);
+        break;
+      case PARSER_FRAME_CONDITIONAL:
+        error = parser_step_conditional (parser, &stack, &value);
+        break;
+      case PARSER_FRAME_COMPOUND:
+        error = parser_step_compound (parser, &stack, &value);
+        break;
+      case PARSER_FRAME_WHILE:
+        error = parser_step_while (parser, &stack, &value);
+        break;
+      case PARSER_FRAME_DECLARATION:
+        error = parser_step_declaration (parser, &stack, &value);
+        break;
+      }
 
-  return parser_parse_expression (parser);
+  free (stack.frames);
+
+  return value;
 }
 
-struct ast *
+uint32_t
 parser_parse_function_prototype(struct parser *parser)
 {
-  struct ast *name;
-  struct ast *result;
+  struct ast *ast = parser->ast;
+  uint32_t name;
+  uint32_t result;
 
   int is_operator = 0;
   double precedence = 1.0;
 
   name = parser_parse_identifier (parser);
-  if (ast_match_error (name))
+  if (ast_match_error (ast, name))
     return name;
 
   if (parser_match (parser, TOKEN_NUMBER))
@@ -635,9 +921,10 @@ parser_parse_function_prototype(struct parser *parser)
   if (parser_advance (parser))
     return parser_error_from_current (parser);
 
-  result = ast_create (AST_PROTOTYPE, parser->location, parser->arena);
+  result = ast_create (ast, AST_PROTOTYPE, parser->location);
 
-  ast_append (result, name);
+  uint32_t mark = ast_mark (ast);
+  ast_append (ast, name);
 
   size_t n_arg = 0;
   int variadic = 0;
@@ -655,13 +942,13 @@ parser_parse_function_prototype(struct parser *parser)
             break;
           }
 
-        struct ast *argument;
+        uint32_t argument;
 
         argument = parser_parse_identifier (parser);
-        if (ast_match_error (argument))
+        if (ast_match_error (ast, argument))
           return argument;
 
-        ast_append (result, argument);
+        ast_append (ast, argument);
         n_arg++;
 
         if (parser_match (parser, TOKEN_RPAREN))
@@ -681,16 +968,19 @@ parser_parse_function_prototype(struct parser *parser)
   if (parser_advance (parser))
     return parser_error_from_current (parser);
 
+  ast_attach (ast, result, mark);
+
   if (is_operator)
     {
       if (n_arg != 2 || variadic)
         {
           struct error e
               = error_create ("binary-operator expects two parameters");
-          return ast_create_e (e, name->location, parser->arena);
+          return ast_create_e (ast, e, ast->location[name]);
         }
 
-      precedence_table_add (name->value.token.value.s, precedence);
+      precedence_table_add (parser->precedence, ast->value[name].s,
+                            precedence, parser->statement);
     }
 
   if (!parser_match (parser, TOKEN_COLON))
@@ -700,56 +990,82 @@ parser_parse_function_prototype(struct parser *parser)
     return parser_error_from_current (parser);
 
   struct type *type = parser_parse_type (parser);
-  type->value.function.variadic = variadic;
-  result->expr_type = type;
 
-  result->state = variadic;
+  /* Types are shared, so the variadic one is a type of its own. */
+  if (variadic && type->kind == TYPE_FUNCTION)
+    {
+      struct type_function function = type->value.function;
+      function.variadic = 1;
+      type = type_create_f (function);
+    }
+
+  ast->expr_type[result] = type;
+
+  ast->state[result] = variadic ? AST_PROTOTYPE_VARIADIC : 0;
+
+  while (1)
+    {
+      if (token_match_string (parser->current, parser->fast_math))
+        ast->state[result] |= AST_PROTOTYPE_FAST_MATH;
+      else if (token_match_string (parser->current, parser->fp_contract))
+        ast->state[result] |= AST_PROTOTYPE_FP_CONTRACT;
+      else if (token_match_string (parser->current,
+                                   parser->flush_denormals))
+        ast->state[result] |= AST_PROTOTYPE_FLUSH_DENORMALS;
+      else
+        break;
+
+      if (parser_advance (parser))
+        return parser_error_from_current (parser);
+    }
+
   return result;
 }
 
-struct ast *
+uint32_t
 parser_parse_top_level_statement(struct parser *parser)
 {
-  struct ast *proto;
+  struct ast *ast = parser->ast;
+  uint32_t proto;
 
   proto = parser_parse_function_prototype (parser);
-  if (ast_match_error (proto))
+  if (ast_match_error (ast, proto))
     return proto;
 
   // if (!parser_match (parser, TOKEN_EQUAL))
   //   return proto;
 
-  if (!parser_match (parser, TOKEN_IDENTIFIER) ||
-      (parser_match (parser, TOKEN_IDENTIFIER) &&
-       strcmp (parser->current.value.s, "=") != 0))
+  if (!token_match_string (parser->current, parser->assign))
     return proto;
 
   if (parser_advance (parser))
     return parser_error_from_current (parser);
 
-  struct ast *expression;
+  uint32_t expression;
 
   expression = parser_parse_expression (parser);
-  if (ast_match_error (expression))
+  if (ast_match_error (ast, expression))
     return expression;
 
-  struct ast *result;
+  uint32_t result;
 
-  result = ast_create (AST_FUNCTION, parser->location, parser->arena);
+  result = ast_create (ast, AST_FUNCTION, parser->location);
 
-  ast_append (result, proto);
-  ast_append (result, expression);
+  uint32_t mark = ast_mark (ast);
+  ast_append (ast, proto);
+  ast_append (ast, expression);
+  ast_attach (ast, result, mark);
 
   return result;
 }
 
-struct ast *
+uint32_t
 parser_parse_statement(struct parser *parser)
 {
-  struct ast *result;
+  uint32_t result;
 
   result = parser_parse_top_level_statement (parser);
-  if (ast_match_error (result))
+  if (ast_match_error (parser->ast, result))
     return result;
 
   if (!parser_match (parser, TOKEN_SEMICOLON))
@@ -761,42 +1077,47 @@ parser_parse_statement(struct parser *parser)
   return result;
 }
 
-struct ast *
+uint32_t
 parser_parse_program(struct parser *parser)
 {
-  struct ast *result;
+  struct ast *ast = parser->ast;
+  uint32_t result;
+
+  result = ast_create (ast, AST_PROGRAM, parser->location);
 
-  result = ast_create (AST_PROGRAM, parser->location, parser->arena);
+  uint32_t mark = ast_mark (ast);
 
   while (1)
     switch (parser->current.type)
       {
       case TOKEN_NOTHING:
+        ast_attach (ast, result, mark);
         return result;
       default:
         {
-          struct ast *statement;
+          uint32_t statement;
 
           statement = parser_parse_statement (parser);
-          if (ast_match_error (statement))
+          if (ast_match_error (ast, statement))
             return statement;
 
-          ast_append (result, statement);
+          ast_append (ast, statement);
+          parser->statement++;
         }
         break;
       }
 }
 
-struct ast *
+uint32_t
 parser_parse (struct parser *parser)
 {
   if (parser_advance (parser))
     return parser_error_from_current (parser);
 
-  struct ast *result;
+  uint32_t result;
 
   result = parser_parse_program (parser);
-  if (ast_match_error (result))
+  if (ast_match_error (parser->ast, result))
     return result;
 
   if (!parser_match (parser, TOKEN_NOTHING))
@@ -808,3 +1129,214 @@ parser_parse (struct parser *parser)
   return result;
 }
 
+/* Chunks with fewer tokens than this are not worth a thread. */
+#define PARSER_CHUNK_MIN (1 << 16)
+
+/* Find where each top-level statement starts: after every semicolon
+   outside of braces and parentheses. 'starts' gets one more entry, the
+   final TOKEN_NOTHING. Operator prototypes, 'name precedence (', are added
+   to 'precedence' on the way. Returns the number of statements. */
+static size_t
+parser_scan (const struct token_stream *stream,
+             struct precedence_table *precedence, size_t **starts)
+{
+  size_t capacity = 64;
+  size_t n = 0;
+  size_t depth = 0;
+
+  *starts = malloc (capacity * sizeof (size_t));
+  (*starts)[0] = 0;
+
+  for (size_t i = 0; i < stream->size; ++i)
+    {
+      struct token token = stream->tokens[i];
+
+      if (i == (*starts)[n] && token_match (token, TOKEN_IDENTIFIER)
+          && i + 2 < stream->size
+          && token_match (stream->tokens[i + 1], TOKEN_NUMBER)
+          && token_match (stream->tokens[i + 2], TOKEN_LPAREN))
+        precedence_table_add (precedence, token.value.s,
+                              stream->tokens[i + 1].value.f, n);
+
+      switch (token.type)
+        {
+        case TOKEN_LPAREN:
+        case TOKEN_LBRACE:
+          depth++;
+          break;
+        case TOKEN_RPAREN:
+        case TOKEN_RBRACE:
+          if (depth)
+            depth--;
+          break;
+        case TOKEN_SEMICOLON:
+          if (depth)
+            break;
+
+          if (n + 2 >= capacity)
+            {
+              capacity *= 2;
+              *starts = realloc (*starts, capacity * sizeof (size_t));
+            }
+
+          (*starts)[++n] = i + 1;
+          break;
+        default:
+          break;
+        }
+    }
+
+  /* Anything after the last semicolon is left to the sequential parser,
+     so its error is reported as usual. */
+  if ((*starts)[n] != stream->size - 1)
+    return 0;
+
+  return n;
+}
+
+struct parser_chunk
+{
+  struct parser parser;
+  const size_t *starts;
+  size_t first;
+  size_t n;
+  struct ast ast;
+  int failed;
+  pthread_t thread;
+};
+
+/* Parse a chunk as a program of its own, made of statements 'first' to
+   'first + n'. */
+static void *
+parser_chunk_run (void *data)
+{
+  struct parser_chunk *chunk = data;
+  struct parser *parser = &chunk->parser;
+  struct ast *ast = &chunk->ast;
+
+  parser->index = chunk->starts[chunk->first];
+  parser->statement = chunk->first;
+  parser_advance (parser);
+
+  uint32_t program = ast_create (ast, AST_PROGRAM, parser->location);
+  uint32_t mark = ast_mark (ast);
+
+  for (size_t i = chunk->first; i < chunk->first + chunk->n; ++i)
+    {
+      uint32_t statement = parser_parse_statement (parser);
+
+      /* Anything unusual is left to the sequential parser. */
+      if (ast_match_error (ast, statement)
+          || parser->index - 1 != chunk->starts[i + 1])
+        {
+          chunk->failed = 1;
+          return NULL;
+        }
+
+      ast_append (ast, statement);
+      parser->statement++;
+    }
+
+  ast_attach (ast, program, mark);
+
+  return NULL;
+}
+
+/* Like 'parser_parse', but parse the top-level statements on up to
+   'threads' threads. Operators are collected before any statement is
+   parsed, and each operator is still only known from the statement
+   declaring it on, so the result is the same. */
+uint32_t
+parser_parse_parallel (struct parser *parser, size_t threads)
+{
+  const struct token_stream *stream = parser->stream;
+
+  if (threads > stream->size / PARSER_CHUNK_MIN)
+    threads = stream->size / PARSER_CHUNK_MIN;
+
+  if (threads <= 1 || !token_match (stream->tokens[stream->size - 1],
+                                    TOKEN_NOTHING))
+    return parser_parse (parser);
+
+  size_t *starts;
+  size_t statements = parser_scan (stream, parser->precedence, &starts);
+
+  if (statements < threads)
+    {
+      free (starts);
+      return parser_parse (parser);
+    }
+
+  parser->precedence->frozen = 1;
+
+  struct parser_chunk *chunks = calloc (threads, sizeof (struct parser_chunk));
+  size_t n = 0;
+  size_t first = 0;
+
+  /* Split into chunks of about the same number of tokens. */
+  for (size_t i = 1; i <= statements; ++i)
+    {
+      size_t end = stream->size / threads * (n + 1);
+
+      if (i < statements && (starts[i] < end || n + 1 == threads))
+        continue;
+
+      struct parser_chunk *chunk = &chunks[n++];
+
+      chunk->starts = starts;
+      chunk->first = first;
+      chunk->n = i - first;
+      chunk->parser = parser_create (stream, parser->precedence,
+                                     &chunk->ast);
+
+      first = i;
+    }
+
+  for (size_t i = 1; i < n; ++i)
+    pthread_create (&chunks[i].thread, NULL, parser_chunk_run, &chunks[i]);
+
+  parser_chunk_run (&chunks[0]);
+
+  for (size_t i = 1; i < n; ++i)
+    pthread_join (chunks[i].thread, NULL);
+
+  int failed = 0;
+  for (size_t i = 0; i < n; ++i)
+    failed |= chunks[i].failed;
+
+  uint32_t result = 0;
+
+  if (!failed)
+    {
+      struct ast *ast = parser->ast;
+
+      parser_advance (parser);
+      result = ast_create (ast, AST_PROGRAM, parser->location);
+
+      uint32_t mark = ast_mark (ast);
+
+      /* Stitch the chunks' statements together in source order. */
+      for (size_t i = 0; i < n; ++i)
+        {
+          uint32_t program = ast_merge (ast, &chunks[i].ast);
+
+          for (uint32_t j = 0; j < ast->children_n[program]; ++j)
+            ast_append (ast, ast_child (ast, program, j));
+        }
+
+      ast_attach (ast, result, mark);
+    }
+
+  for (size_t i = 0; i < n; ++i)
+    ast_destroy (&chunks[i].ast);
+
+  free (chunks);
+  free (starts);
+
+  parser->precedence->frozen = 0;
+
+  if (failed)
+    return parser_parse (parser);
+
+  return result;
+}
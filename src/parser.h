@@ -1,21 +1,60 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "ast.h"
 #include "lexer.h"
 
+struct precedence
+{
+  const char *key;
+  double precedence;
+  /* The top-level statement declaring the operator; it is unknown to the
+     statements before it. */
+  uint32_t statement;
+};
+
+/* Binary operators and their precedences, keyed by interned spelling. */
+struct precedence_table
+{
+  struct precedence *entries;
+  size_t capacity;
+  size_t size;
+
+  /* Set once every operator was collected up front. Adding is then a
+     no-op, so parsers on several threads can share the table. */
+  int frozen;
+};
+
 struct parser
 {
-  struct lexer *lexer;
+  const struct token_stream *stream;
+  size_t index;
+  struct precedence_table *precedence;
+  /* The tree being built. */
+  struct ast *ast;
+  /* Index of the top-level statement being parsed. */
+  uint32_t statement;
   struct token current;
   struct location location;
-  struct arena *arena;
+
+  /* Interned "=", used for declarations and definitions. */
+  const char *assign;
+  /* Interned annotations that may follow a prototype's type. */
+  const char *fast_math;
+  const char *fp_contract;
+  const char *flush_denormals;
+  /* Interned spellings of the built-in operators, by 'enum ast_operator'. */
+  const char *operators[AST_OPERATOR_USER];
 };
 
-struct parser parser_create (struct lexer *lexer, struct arena *);
-struct ast *parser_parse (struct parser *);
+struct parser parser_create (const struct token_stream *,
+                             struct precedence_table *, struct ast *);
+uint32_t parser_parse (struct parser *);
+uint32_t parser_parse_parallel (struct parser *, size_t);
 
-void precedence_table_add (const char *key, double precedence);
-void precedence_table_destroy ();
+void precedence_table_add (struct precedence_table *, const char *key,
+                           double precedence, uint32_t statement);
+void precedence_table_destroy (struct precedence_table *);
 
 #endif // PARSER_H
 
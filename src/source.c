@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE
+
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int
+source_stream (struct source *source, int fd)
+{
+  size_t capacity = 64 * 1024;
+  size_t size = 0;
+  char *buffer = malloc (capacity);
+
+  if (!buffer)
+    return -1;
+
+  while (1)
+    {
+      if (size + 1 >= capacity)
+        {
+          char *t = realloc (buffer, capacity * 2);
+          if (!t)
+            {
+              free (buffer);
+              return -1;
+            }
+          buffer = t;
+          capacity *= 2;
+        }
+
+      ssize_t n = read (fd, buffer + size, capacity - size - 1);
+
+      if (n == 0)
+        break;
+
+      if (n < 0)
+        {
+          free (buffer);
+          return -1;
+        }
+
+      size += n;
+
+      if (size >= UINT32_MAX)
+        {
+          free (buffer);
+          errno = EFBIG;
+          return -1;
+        }
+    }
+
+  buffer[size] = '\0';
+
+  source->data = buffer;
+  source->size = size;
+  source->mapped = 0;
+
+  return 0;
+}
+
+static int
+source_map (struct source *source, int fd, size_t size)
+{
+  if (size >= UINT32_MAX)
+    {
+      errno = EFBIG;
+      return -1;
+    }
+
+  size_t page = sysconf (_SC_PAGESIZE);
+  size_t length = (size + page - 1) / page * page + page;
+
+  /* Reserve the file pages plus one zero page, then map the file over the
+     front of the reservation. Whatever follows the last byte of the file is
+     zero-filled, which gives the lexer its '\0' even when the file size is
+     an exact multiple of the page size. */
+  char *base = mmap (NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+  if (base == MAP_FAILED)
+    return -1;
+
+  if (size > 0
+      && mmap (base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+             == MAP_FAILED)
+    {
+      munmap (base, length);
+      return -1;
+    }
+
+  madvise (base, size, MADV_SEQUENTIAL);
+
+  source->data = base;
+  source->size = size;
+  source->mapped = length;
+
+  return 0;
+}
+
+int
+source_open (struct source *source, const char *path)
+{
+  int fd;
+
+  if (strcmp (path, "-") == 0)
+    fd = STDIN_FILENO;
+  else if ((fd = open (path, O_RDONLY)) < 0)
+    return -1;
+
+  struct stat st;
+  int result;
+
+  if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode))
+    {
+      result = source_map (source, fd, st.st_size);
+
+      if (result != 0 && errno != EFBIG)
+        result = source_stream (source, fd);
+    }
+  else
+    result = source_stream (source, fd);
+
+  int saved = errno;
+
+  if (fd != STDIN_FILENO)
+    close (fd);
+
+  errno = saved;
+  return result;
+}
+
+void
+source_close (struct source *source)
+{
+  if (source->mapped)
+    munmap ((void *)source->data, source->mapped);
+  else
+    free ((void *)source->data);
+
+  source->data = NULL;
+  source->size = 0;
+  source->mapped = 0;
+}
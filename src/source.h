@@ -0,0 +1,21 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+/* A read-only view of an input file. Regular files are mapped directly;
+   pipes, character devices and "-" (stdin) are streamed into a buffer.
+   In both cases 'data[size]' is a readable '\0', so the lexer can keep
+   relying on the terminator instead of carrying an end pointer. Tokens
+   address the source with 32-bit offsets, so larger files are refused. */
+struct source
+{
+  const char *data;
+  size_t size;
+  size_t mapped;
+};
+
+int source_open (struct source *, const char *);
+void source_close (struct source *);
+
+#endif // SOURCE_H
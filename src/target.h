@@ -0,0 +1,15 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <stddef.h>
+
+/* The CPUs and features LLVM 14 has for the architecture of a target
+   triple, so that names it does not know can be rejected up front: it
+   only warns about them and then fails on the first function. Targets
+   without a table accept any name. */
+
+int target_cpu_known (const char *triple, const char *cpu);
+const char *target_features_unknown (const char *triple, const char *features,
+                                     size_t *length);
+
+#endif // TARGET_H
@@ -1,4 +1,3 @@
-#include "string.h"
 #include "token.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,22 +37,22 @@ token_type_string (enum token_type type)
 }
 
 struct token
-token_create (enum token_type type, struct location location)
+token_create (enum token_type type, uint32_t offset)
 {
   struct token token;
 
   token.type = type;
-  token.location = location;
+  token.offset = offset;
 
   return token;
 }
 
 struct token
-token_create_e (struct error error, struct location location)
+token_create_e (size_t error, uint32_t offset)
 {
   struct token token;
 
-  token = token_create (TOKEN_ERROR, location);
+  token = token_create (TOKEN_ERROR, offset);
 
   token.value.error = error;
 
@@ -61,11 +60,11 @@ token_create_e (struct error error, struct location location)
 }
 
 struct token
-token_create_f (double f, enum token_type type, struct location location)
+token_create_f (double f, enum token_type type, uint32_t offset)
 {
   struct token token;
 
-  token = token_create (type, location);
+  token = token_create (type, offset);
 
   token.value.f = f;
 
@@ -73,11 +72,11 @@ token_create_f (double f, enum token_type type, struct location location)
 }
 
 struct token
-token_create_s (char *s, enum token_type type, struct location location)
+token_create_s (const char *s, enum token_type type, uint32_t offset)
 {
   struct token token;
 
-  token = token_create (type, location);
+  token = token_create (type, offset);
 
   token.value.s = s;
 
@@ -85,14 +84,15 @@ token_create_s (char *s, enum token_type type, struct location location)
 }
 
 struct token
-token_copy (struct token token, struct arena *arena)
+token_copy (struct token token)
 {
   struct token copy;
 
+  /* Identifiers are interned, so the pointer is shared. */
   switch (token.type)
     {
     case TOKEN_IDENTIFIER:
-      copy.value.s = string_copy (token.value.s, arena);
+      copy.value.s = token.value.s;
       break;
     case TOKEN_NUMBER:
       copy.value.f = token.value.f;
@@ -102,24 +102,11 @@ token_copy (struct token token, struct arena *arena)
     }
 
   copy.type = token.type;
-  copy.location = token.location;
+  copy.offset = token.offset;
 
   return copy;
 }
 
-void
-token_destroy (struct token token)
-{
-  switch (token.type)
-    {
-    case TOKEN_IDENTIFIER:
-      free (token.value.s);
-      break;
-    default:
-      break;
-    }
-}
-
 int
 token_match (struct token token, enum token_type type)
 {
@@ -132,6 +119,12 @@ token_match_error (struct token token)
   return token_match (token, TOKEN_ERROR);
 }
 
+int
+token_match_string (struct token token, const char *s)
+{
+  return token_match (token, TOKEN_IDENTIFIER) && token.value.s == s;
+}
+
 void
 token_debug_print (struct token token)
 {
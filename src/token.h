@@ -2,15 +2,16 @@
 #define TOKEN_H
 
 #include "error.h"
-
-struct arena;
+#include <stdint.h>
 
 union token_entry
 {
-  struct error error;
+  /* Index into the lexer's 'struct diagnostics'. */
+  size_t error;
   // long i;
   double f;
-  char *s;
+  /* Interned, see 'intern.h'. */
+  const char *s;
 };
 
 enum token_type
@@ -42,26 +43,27 @@ enum token_type
   // TOKEN_EXTERN
 };
 
+/* 16 bytes: tokens are copied by value from the stream into the parser
+   and the AST, so they carry only a byte offset into the source. */
 struct token
 {
   union token_entry value;
   enum token_type type;
-  struct location location;
+  uint32_t offset;
 };
 
 const char *token_type_string (enum token_type);
 
-struct token token_create (enum token_type, struct location);
-struct token token_create_e (struct error, struct location);
-struct token token_create_f (double, enum token_type, struct location);
-struct token token_create_s (char *, enum token_type, struct location);
-
-struct token token_copy (struct token, struct arena *);
+struct token token_create (enum token_type, uint32_t);
+struct token token_create_e (size_t, uint32_t);
+struct token token_create_f (double, enum token_type, uint32_t);
+struct token token_create_s (const char *, enum token_type, uint32_t);
 
-void token_destroy (struct token);
+struct token token_copy (struct token);
 
 int token_match (struct token, enum token_type);
 int token_match_error (struct token);
+int token_match_string (struct token, const char *);
 
 void token_debug_print (struct token);
 
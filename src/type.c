@@ -1,7 +1,10 @@
 #include "type.h"
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const char *const TYPE_KIND_STRING[] = {
   "Void",
@@ -16,37 +19,136 @@ type_kind_string (enum type_kind kind)
   return TYPE_KIND_STRING[kind];
 }
 
+static struct type TYPE_PRIMITIVE[] = {
+  [TYPE_VOID] = { .kind = TYPE_VOID },
+  [TYPE_F64] = { .kind = TYPE_F64 },
+  [TYPE_BOOL] = { .kind = TYPE_BOOL },
+};
+
+/* Function types, hashed by the pointers of their (already interned)
+   return and argument types. Parser threads create types concurrently,
+   so the table is behind one lock; it only ever holds a handful of
+   signatures. */
+static struct
+{
+  pthread_mutex_t lock;
+  struct arena arena;
+  struct type **table;
+  size_t capacity;
+  size_t n;
+} TYPE_FUNCTIONS = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
 struct type *
-type_create (enum type_kind kind, struct arena *arena)
+type_create (enum type_kind kind)
 {
-  struct type *type;
+  assert (kind != TYPE_FUNCTION);
+
+  return &TYPE_PRIMITIVE[kind];
+}
 
-  if (arena)
-    type = arena_alloc (arena, sizeof (struct type));
-  else
-    type = calloc (1, sizeof (struct type));
+static size_t
+type_function_hash (struct type_function function)
+{
+  uint64_t hash = 14695981039346656037u;
 
-  type->kind = kind;
+  hash = (hash ^ (uintptr_t)function.return_t) * 1099511628211u;
+  hash = (hash ^ (size_t)function.variadic) * 1099511628211u;
 
-  return type;
+  for (size_t i = 0; i < function.argument_n; ++i)
+    hash = (hash ^ (uintptr_t)function.argument_t[i]) * 1099511628211u;
+
+  return (size_t)(hash ^ (hash >> 32));
 }
 
+static int
+type_function_equal (struct type_function f1, struct type_function f2)
+{
+  return f1.return_t == f2.return_t && f1.variadic == f2.variadic
+         && f1.argument_n == f2.argument_n
+         && memcmp (f1.argument_t, f2.argument_t,
+                    f1.argument_n * sizeof (struct type *)) == 0;
+}
+
+static void
+type_functions_grow (void)
+{
+  size_t capacity = TYPE_FUNCTIONS.capacity ? TYPE_FUNCTIONS.capacity * 2
+                                            : 64;
+  struct type **table = calloc (capacity, sizeof (struct type *));
+
+  for (size_t i = 0; i < TYPE_FUNCTIONS.capacity; ++i)
+    {
+      struct type *type = TYPE_FUNCTIONS.table[i];
+
+      if (!type)
+        continue;
+
+      size_t j = type_function_hash (type->value.function) & (capacity - 1);
+      while (table[j])
+        j = (j + 1) & (capacity - 1);
+
+      table[j] = type;
+    }
+
+  free (TYPE_FUNCTIONS.table);
+
+  TYPE_FUNCTIONS.table = table;
+  TYPE_FUNCTIONS.capacity = capacity;
+}
+
+/* 'function.argument_t' is only read; the caller keeps ownership. */
 struct type *
-type_create_f (struct type_function function, struct arena *arena)
+type_create_f (struct type_function function)
 {
+  pthread_mutex_lock (&TYPE_FUNCTIONS.lock);
+
+  if (TYPE_FUNCTIONS.n * 2 >= TYPE_FUNCTIONS.capacity)
+    type_functions_grow ();
+
+  size_t mask = TYPE_FUNCTIONS.capacity - 1;
+  size_t i = type_function_hash (function) & mask;
   struct type *type;
 
-  type = type_create (TYPE_FUNCTION, arena);
+  for (; (type = TYPE_FUNCTIONS.table[i]); i = (i + 1) & mask)
+    if (type_function_equal (type->value.function, function))
+      break;
 
-  type->value.function = function;
+  if (!type)
+    {
+      size_t size = function.argument_n * sizeof (struct type *);
+
+      type = arena_alloc (&TYPE_FUNCTIONS.arena, sizeof (struct type));
+      type->kind = TYPE_FUNCTION;
+      type->value.function = function;
+      type->value.function.argument_t = NULL;
+
+      if (size > 0)
+        {
+          type->value.function.argument_t
+              = arena_alloc (&TYPE_FUNCTIONS.arena, size);
+          memcpy (type->value.function.argument_t, function.argument_t,
+                  size);
+        }
+
+      TYPE_FUNCTIONS.table[i] = type;
+      TYPE_FUNCTIONS.n++;
+    }
+
+  pthread_mutex_unlock (&TYPE_FUNCTIONS.lock);
 
   return type;
 }
 
+/* Free every function type. Types must not be used afterwards. */
 void
-type_destroy (struct type *type)
+type_destroy (void)
 {
-  free (type);
+  free (TYPE_FUNCTIONS.table);
+  arena_destroy (&TYPE_FUNCTIONS.arena);
+
+  TYPE_FUNCTIONS.table = NULL;
+  TYPE_FUNCTIONS.capacity = 0;
+  TYPE_FUNCTIONS.n = 0;
 }
 
 void
@@ -84,35 +186,7 @@ type_debug_print (struct type *type)
 int
 type_match (struct type *t1, struct type *t2)
 {
-  if (t1->kind != t2->kind)
-    return 0;
-
-  switch (t1->kind)
-    {
-    case TYPE_FUNCTION:
-      {
-        struct type_function f1 = t1->value.function;
-        struct type_function f2 = t2->value.function;
-
-        if (f1.argument_n != f2.argument_n)
-          return 0;
-
-        if (f1.variadic != f2.variadic)
-          return 0;
-
-        if (type_match (f1.return_t, f2.return_t) == 0)
-          return 0;
-
-        for (size_t i = 0; i < f1.argument_n; ++i)
-          if (type_match (f1.argument_t[i], f2.argument_t[i]) == 0)
-            return 0;
-
-        return 1;
-      }
-      break;
-    default:
-      return t1->kind == t2->kind;
-    }
+  return t1 == t2;
 }
 
 int
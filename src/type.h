@@ -33,10 +33,15 @@ struct type
 
 const char *type_kind_string (enum type_kind);
 
-struct type *type_create (enum type_kind, struct arena *);
-struct type *type_create_f (struct type_function, struct arena *);
+/* Types are interned: there is one 'struct type' per distinct type, so two
+   types are equal iff their pointers are equal. Primitive types are
+   static singletons, and function types are hash-consed, with their
+   argument array copied into the interner. */
 
-void type_destroy (struct type *);
+struct type *type_create (enum type_kind);
+struct type *type_create_f (struct type_function);
+
+void type_destroy (void);
 
 void type_debug_print (struct type *);
 